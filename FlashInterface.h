@@ -19,6 +19,34 @@
 
 #pragma once
 
+#include <stdint.h>
+#include <string.h>
+
+// One (offset, ptr, len) piece of a vectored operation within a single EB
+typedef struct {
+    int offset;
+    const void *data;
+    int size;
+} FlashProgramVec;
+
+typedef struct {
+    int offset;
+    void *data;
+    int size;
+} FlashReadVec;
+
+// Completion notification for asynchronous operations
+typedef void (*FlashCallback)(void *arg, bool ok);
+
+// Why the FTL is touching the flash, for write amplification accounting
+typedef enum {
+    FlashCategoryHost = 0,      // Host data reads and writes
+    FlashCategoryGC,            // Garbage collection and wear leveling relocation
+    FlashCategoryMetaPersist,   // Writing out the L2P and other metadata
+    FlashCategoryMetaAge,       // Moving aged-out metadata EBs
+    FlashCategories
+} FlashCategory;
+
 // Subclass this and implement your own flash (or DRAM for host-based debugging) accessors
 class FlashInterface {
 public:
@@ -27,8 +55,12 @@ public:
 
     // Need to know how large this flash device is.
     virtual int size() = 0;
-    // What's a safe size to write (must be < 512b)
+    // Size of every program() call and of each programv() piece holding host data.  Must evenly divide the LBA size.
     virtual int writeBufferSize() = 0;
+    // Erase granularity.  Larger (32KB/64KB) block erases are much faster per byte on most SPI NOR
+    virtual int eraseBlockSize() {
+        return 4096;
+    }
 
     // For emulation, preserve state between runs.  No-op on real hardware
     virtual void serialize() { }
@@ -38,6 +70,64 @@ public:
     virtual const uint8_t *readEB(int eb) = 0;
 
     virtual bool eraseBlock(int eb) = 0; // Erase an entire EB
-    virtual bool program(int eb, int offset, const void *data, int size) = 0; // Program a small region of an EB.  Must support programming at `writeBufferSize()`
+    virtual bool program(int eb, int offset, const void *data, int size) = 0; // Program `writeBufferSize()` bytes of an EB
     virtual bool read(int eb, int offset, void *data, int size) = 0; // Read flash, guaranteed not to cross an EB
+
+    // Batched versions of program() and read() for multiple regions of a single EB.  Override these to amortize
+    // per-operation setup costs, but keep each piece separately interruptible: a batch can cover a whole EB.
+    // Program data may point into flash returned by readEB(), so the default copies it into RAM one
+    // writeBufferSize() chunk at a time (sizes are multiples of writeBufferSize()).
+    virtual bool programv(int eb, const FlashProgramVec *vec, int count) {
+        int wbs = writeBufferSize();
+        uint8_t buff[wbs];
+        for (int i = 0; i < count; i++) {
+            for (int j = 0; j < vec[i].size; j += wbs) {
+                memcpy(buff, (const uint8_t *)vec[i].data + j, wbs);
+                if (!program(eb, vec[i].offset + j, buff, wbs)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    virtual bool readv(int eb, const FlashReadVec *vec, int count) {
+        for (int i = 0; i < count; i++) {
+            if (!read(eb, vec[i].offset, vec[i].data, vec[i].size)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Asynchronous erase and program.  Operations execute in the order they are started, and any synchronous call
+    // must wait for earlier asynchronous ones to finish.  Program data must stay valid until completion and may
+    // point into readEB() memory (it is only read when the operation executes).  Callbacks are made from inside
+    // poll(), which returns the number of operations still outstanding.  The defaults just run synchronously and
+    // call back immediately.
+    virtual bool startErase(int eb, FlashCallback cb, void *arg) {
+        bool ok = eraseBlock(eb);
+        if (cb) {
+            cb(arg, ok);
+        }
+        return ok;
+    }
+
+    virtual bool startProgram(int eb, int offset, const void *data, int size, FlashCallback cb, void *arg) {
+        FlashProgramVec vec = {offset, data, size};
+        bool ok = programv(eb, &vec, 1);
+        if (cb) {
+            cb(arg, ok);
+        }
+        return ok;
+    }
+
+    virtual int poll() {
+        return 0;
+    }
+
+    // The FTL tags every following operation with its purpose.  Only of interest to accounting wrappers.
+    virtual void setCategory(FlashCategory category) {
+        (void) category;
+    }
 };
@@ -0,0 +1,158 @@
+/*
+    FlashInterfaceCounter.h - Operation counting wrapper for any FlashInterface
+
+    Copyright (c) 2024 Earle F. Philhower, III <earlephilhower@yahoo.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program. If not, see https://www.gnu.org/licenses/
+*/
+
+#pragma once
+
+#include "FlashInterface.h"
+
+typedef struct {
+    uint32_t erases;
+    uint32_t programs;
+    uint64_t programBytes;
+    uint32_t reads;
+    uint64_t readBytes;
+    uint32_t readEBs;
+} FlashCounts;
+
+// Point in time copy of all counters, indexed by FlashCategory
+typedef struct {
+    FlashCounts category[FlashCategories];
+
+    FlashCounts total() const {
+        FlashCounts t = {};
+        for (int i = 0; i < FlashCategories; i++) {
+            t.erases += category[i].erases;
+            t.programs += category[i].programs;
+            t.programBytes += category[i].programBytes;
+            t.reads += category[i].reads;
+            t.readBytes += category[i].readBytes;
+            t.readEBs += category[i].readEBs;
+        }
+        return t;
+    }
+
+    // Bytes programmed to flash per byte of host data.  0 until the host has written anything.
+    double writeAmplification() const {
+        uint64_t host = category[FlashCategoryHost].programBytes;
+        return host ? (double)total().programBytes / host : 0.0;
+    }
+} FlashCounterSnapshot;
+
+// Wraps another FlashInterface and counts every operation and byte passing through it by the category the FTL
+// says it's working on.  Adds only a few increments per call, so it can stay in place in production.
+class FlashInterfaceCounter : public FlashInterface {
+public:
+    FlashInterfaceCounter(FlashInterface *fi) : _fi(fi) {
+        reset();
+    }
+
+    virtual ~FlashInterfaceCounter() override {
+    }
+
+    FlashCounterSnapshot snapshot() {
+        return _counts;
+    }
+
+    void reset() {
+        bzero(&_counts, sizeof(_counts));
+    }
+
+    virtual int size() override {
+        return _fi->size();
+    }
+
+    virtual int writeBufferSize() override {
+        return _fi->writeBufferSize();
+    }
+
+    virtual int eraseBlockSize() override {
+        return _fi->eraseBlockSize();
+    }
+
+    virtual void serialize() override {
+        _fi->serialize();
+    }
+
+    virtual void deserialize() override {
+        _fi->deserialize();
+    }
+
+    virtual const uint8_t *readEB(int eb) override {
+        _cur->readEBs++;
+        return _fi->readEB(eb);
+    }
+
+    virtual bool eraseBlock(int eb) override {
+        _cur->erases++;
+        return _fi->eraseBlock(eb);
+    }
+
+    virtual bool program(int eb, int offset, const void *data, int size) override {
+        _cur->programs++;
+        _cur->programBytes += size;
+        return _fi->program(eb, offset, data, size);
+    }
+
+    virtual bool read(int eb, int offset, void *data, int size) override {
+        _cur->reads++;
+        _cur->readBytes += size;
+        return _fi->read(eb, offset, data, size);
+    }
+
+    virtual bool programv(int eb, const FlashProgramVec *vec, int count) override {
+        for (int i = 0; i < count; i++) {
+            _cur->programs++;
+            _cur->programBytes += vec[i].size;
+        }
+        return _fi->programv(eb, vec, count);
+    }
+
+    virtual bool readv(int eb, const FlashReadVec *vec, int count) override {
+        for (int i = 0; i < count; i++) {
+            _cur->reads++;
+            _cur->readBytes += vec[i].size;
+        }
+        return _fi->readv(eb, vec, count);
+    }
+
+    virtual bool startErase(int eb, FlashCallback cb, void *arg) override {
+        _cur->erases++;
+        return _fi->startErase(eb, cb, arg);
+    }
+
+    virtual bool startProgram(int eb, int offset, const void *data, int size, FlashCallback cb, void *arg) override {
+        _cur->programs++;
+        _cur->programBytes += size;
+        return _fi->startProgram(eb, offset, data, size, cb, arg);
+    }
+
+    virtual int poll() override {
+        return _fi->poll();
+    }
+
+    virtual void setCategory(FlashCategory category) override {
+        _cur = &_counts.category[category];
+        _fi->setCategory(category);
+    }
+
+private:
+    FlashInterface *_fi;
+    FlashCounterSnapshot _counts;
+    FlashCounts *_cur = &_counts.category[FlashCategoryHost];
+};
@@ -0,0 +1,172 @@
+/*
+    FlashInterfaceMmap.h - Host flash emulation backed by a memory-mapped file
+
+    Copyright (c) 2024 Earle F. Philhower, III <earlephilhower@yahoo.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program. If not, see https://www.gnu.org/licenses/
+*/
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "FlashInterface.h"
+
+// File-backed simulation for host-based testing, NBD, etc.  The image is mapped directly, so there is nothing to
+// load on startup and the kernel keeps every write even if the process dies.  serialize() only needs to msync()
+// the EBs changed since last time to survive an OS crash.  New images are sparse and erases punch holes, so
+// emulating a huge device costs only what has actually been written.  An existing image must already be `size`
+// bytes, so a mistyped size can't truncate it.
+class FlashInterfaceMmap : public FlashInterface {
+public:
+    FlashInterfaceMmap(const char *path, int size, int ebSize = 4096) : ebBytes(ebSize) {
+        _flashSize = 0;
+        _flash = nullptr;
+        _fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (_fd < 0) {
+            perror("FlashInterfaceMmap: open");
+            return;
+        }
+        struct stat st;
+        if (fstat(_fd, &st) || (!st.st_size && ftruncate(_fd, size))) {
+            perror("FlashInterfaceMmap: size");
+            close(_fd);
+            _fd = -1;
+            return;
+        }
+        if (st.st_size && (st.st_size != size)) {
+            fprintf(stderr, "FlashInterfaceMmap: %s is %lld bytes, not %d\n", path, (long long)st.st_size, size);
+            close(_fd);
+            _fd = -1;
+            return;
+        }
+        void *m = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+        if (m == MAP_FAILED) {
+            perror("FlashInterfaceMmap: mmap");
+            close(_fd);
+            _fd = -1;
+            return;
+        }
+        _flash = (uint8_t *)m;
+        _flashSize = size;
+        _isDirty = new uint8_t[_flashSize / ebBytes];
+        bzero(_isDirty, _flashSize / ebBytes);
+    }
+
+    virtual ~FlashInterfaceMmap() override {
+        if (_flash) {
+            serialize();
+            munmap(_flash, _flashSize);
+            delete[] _isDirty;
+        }
+        if (_fd >= 0) {
+            close(_fd);
+        }
+    }
+
+    // 0 if the image could not be opened
+    virtual int size() override {
+        return _flashSize;
+    }
+
+    virtual int writeBufferSize() override {
+        return 128;
+    }
+
+    virtual int eraseBlockSize() override {
+        return ebBytes;
+    }
+
+    virtual const uint8_t *readEB(int eb) override {
+        return &_flash[eb * ebBytes];
+    }
+
+    // Flush only the EBs changed since the last call, coalescing adjacent ones
+    virtual void serialize() override {
+        int ebs = _flashSize / ebBytes;
+        for (int i = 0; i < ebs; i++) {
+            if (!_isDirty[i]) {
+                continue;
+            }
+            int j = i;
+            while ((j < ebs) && _isDirty[j]) {
+                _isDirty[j++] = 0;
+            }
+            msync(&_flash[i * ebBytes], (j - i) * ebBytes, MS_SYNC);
+            i = j;
+        }
+        // Hole punches are file metadata, which msync() doesn't cover
+        if (_punched) {
+            fdatasync(_fd);
+            _punched = false;
+        }
+    }
+
+    virtual void deserialize() override {
+        // The mapping is the image, nothing to do
+    }
+
+    virtual bool eraseBlock(int eb) override {
+        if (eb < _flashSize / ebBytes) {
+            // Give the space back to the filesystem if we can.  The mapping reads back 0s either way.
+            if (fallocate(_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)eb * ebBytes, ebBytes)) {
+                bzero(&_flash[eb * ebBytes], ebBytes);
+            } else {
+                _punched = true;
+            }
+            _isDirty[eb] = 1;
+            return true;
+        }
+        return false;
+    }
+
+    virtual bool program(int eb, int offset, const void *data, int size) override {
+        if (eb < _flashSize / ebBytes) {
+            _isDirty[eb] = 1;
+            memcpy(&_flash[eb * ebBytes + offset], data, size);
+            return true;
+        }
+        return false;
+    }
+
+    virtual bool read(int eb, int offset, void *data, int size) override {
+        if (eb < _flashSize / ebBytes) {
+            memcpy(data, &_flash[eb * ebBytes + offset], size);
+            return true;
+        }
+        return false;
+    }
+
+    virtual bool programv(int eb, const FlashProgramVec *vec, int count) override {
+        if (eb < _flashSize / ebBytes) {
+            _isDirty[eb] = 1;
+            for (int i = 0; i < count; i++) {
+                memcpy(&_flash[eb * ebBytes + vec[i].offset], vec[i].data, vec[i].size);
+            }
+            return true;
+        }
+        return false;
+    }
+
+private:
+    const int ebBytes;
+    int _flashSize;
+    int _fd;
+    uint8_t *_flash;
+    uint8_t *_isDirty;
+    bool _punched = false;
+};
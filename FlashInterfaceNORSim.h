@@ -0,0 +1,326 @@
+/*
+    FlashInterfaceNORSim.h - SPI NOR flash timing and wear simulator for SPIFTL
+
+    Copyright (c) 2024 Earle F. Philhower, III <earlephilhower@yahoo.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program. If not, see https://www.gnu.org/licenses/
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include "FlashInterface.h"
+
+// Datasheet timings for a NOR part.  All times in microseconds unless noted.
+typedef struct {
+    const char *name;
+    int pageBytes;          // Largest single program, real parts wrap around within a page
+    uint32_t tPP;           // Page program
+    uint32_t tSE;           // 4KB sector erase
+    uint32_t tBE32;         // 32KB block erase
+    uint32_t tBE64;         // 64KB block erase
+    uint32_t readSetupNS;   // Command/address/dummy cycles for a read
+    uint32_t readNSPerByte;
+    bool eraseSuspend;      // Can reads interrupt an erase?
+    uint32_t tSUS;          // Suspend + resume overhead
+    uint32_t endurance;     // Rated PE cycles
+} NORFlashProfile;
+
+static const NORFlashProfile W25Q128JVTypical = {"W25Q128JV-typ", 256, 400, 45000, 120000, 150000, 100, 15, true, 20, 100000};
+static const NORFlashProfile W25Q128JVMax = {"W25Q128JV-max", 256, 3000, 400000, 1600000, 2000000, 100, 15, true, 20, 100000};
+
+// Latency samples for a single operation type, reported as percentiles
+class NORSimHistogram {
+public:
+    void add(uint64_t ns) {
+        _samples.push_back(ns);
+        _sorted = false;
+    }
+
+    size_t count() {
+        return _samples.size();
+    }
+
+    uint64_t percentile(double p) {
+        if (_samples.empty()) {
+            return 0;
+        }
+        if (!_sorted) {
+            std::sort(_samples.begin(), _samples.end());
+            _sorted = true;
+        }
+        size_t idx = std::min(_samples.size() - 1, (size_t)(p / 100.0 * _samples.size()));
+        return _samples[idx];
+    }
+
+    void clear() {
+        _samples.clear();
+    }
+
+private:
+    std::vector<uint64_t> _samples;
+    bool _sorted = true;
+};
+
+// Flash emulation which enforces NOR semantics (erase to 0xFF, program can only clear bits, programs split per page) and
+// charges every operation its datasheet time on a virtual clock, so device latency and throughput can be predicted
+// from host runs without waiting for them.  Asynchronous operations queue behind each other like the real part.
+class FlashInterfaceNORSim : public FlashInterface {
+public:
+    FlashInterfaceNORSim(int size, const NORFlashProfile &profile, int ebSize = 4096) : ebBytes(ebSize), _profile(profile) {
+        _flashSize = size;
+        _flash = new uint8_t[_flashSize];
+        memset(_flash, 0xff, _flashSize); // Fresh from the factory
+        _wear = new uint32_t[_flashSize / ebBytes];
+        bzero(_wear, sizeof(uint32_t) * (_flashSize / ebBytes));
+    }
+
+    virtual ~FlashInterfaceNORSim() override {
+        delete[] _wear;
+        delete[] _flash;
+    }
+
+    virtual int size() override {
+        return _flashSize;
+    }
+
+    virtual int writeBufferSize() override {
+        return std::min(_profile.pageBytes, 256);
+    }
+
+    virtual int eraseBlockSize() override {
+        return ebBytes;
+    }
+
+    // Memory-mapped access only pays for the read command, the FTL mostly looks at headers this way
+    virtual const uint8_t *readEB(int eb) override {
+        charge(readNS(0), &_readStats);
+        return &_flash[eb * ebBytes];
+    }
+
+    virtual bool eraseBlock(int eb) override {
+        if (eb >= _flashSize / ebBytes) {
+            return false;
+        }
+        _now = std::max(_now, _busyUntil);
+        doErase(eb);
+        _eraseStats.add(eraseNS());
+        _now += eraseNS();
+        _busyUntil = _now;
+        return true;
+    }
+
+    virtual bool program(int eb, int offset, const void *data, int size) override {
+        if (eb >= _flashSize / ebBytes) {
+            return false;
+        }
+        _now = std::max(_now, _busyUntil);
+        uint64_t ns = doProgram(eb, offset, (const uint8_t *)data, size);
+        _programStats.add(ns);
+        _now += ns;
+        _busyUntil = _now;
+        return true;
+    }
+
+    virtual bool read(int eb, int offset, void *data, int size) override {
+        if (eb >= _flashSize / ebBytes) {
+            return false;
+        }
+        charge(readNS(size), &_readStats);
+        memcpy(data, &_flash[eb * ebBytes + offset], size);
+        return true;
+    }
+
+    // Effects are applied immediately (we're single threaded and in order), only completion is deferred
+    virtual bool startErase(int eb, FlashCallback cb, void *arg) override {
+        if (eb >= _flashSize / ebBytes) {
+            return false;
+        }
+        doErase(eb);
+        uint64_t start = std::max(_now, _busyUntil);
+        _busyUntil = start + eraseNS();
+        _eraseStats.add(_busyUntil - _now);
+        _pending.push_back({start, _busyUntil, true, cb, arg});
+        return true;
+    }
+
+    virtual bool startProgram(int eb, int offset, const void *data, int size, FlashCallback cb, void *arg) override {
+        if (eb >= _flashSize / ebBytes) {
+            return false;
+        }
+        uint64_t start = std::max(_now, _busyUntil);
+        _busyUntil = start + doProgram(eb, offset, (const uint8_t *)data, size);
+        _programStats.add(_busyUntil - _now);
+        _pending.push_back({start, _busyUntil, false, cb, arg});
+        return true;
+    }
+
+    // Someone polling us is waiting, so if nothing is done yet let time pass until the next completion
+    virtual int poll() override {
+        if (!_pending.empty() && (_pending.front().done > _now)) {
+            _now = _pending.front().done;
+        }
+        while (!_pending.empty() && (_pending.front().done <= _now)) {
+            Pending p = _pending.front();
+            _pending.pop_front();
+            if (p.cb) {
+                p.cb(p.arg, true);
+            }
+        }
+        return _pending.size();
+    }
+
+    // Virtual time in ns.  Callers can advance it to model their own CPU work.
+    uint64_t now() {
+        return _now;
+    }
+
+    void advance(uint64_t ns) {
+        _now += ns;
+    }
+
+    uint32_t wear(int eb) {
+        return _wear[eb];
+    }
+
+    void report(FILE *f) {
+        uint32_t maxWear = 0;
+        uint32_t minWear = ~0U;
+        for (int i = 0; i < _flashSize / ebBytes; i++) {
+            maxWear = std::max(maxWear, _wear[i]);
+            minWear = std::min(minWear, _wear[i]);
+        }
+        fprintf(f, "%s: %d byte EBs, virtual time %.3f s\n", _profile.name, ebBytes, _now / 1e9);
+        reportOne(f, "erase", _eraseStats);
+        reportOne(f, "program", _programStats);
+        reportOne(f, "read", _readStats);
+        fprintf(f, "  wear: min %u max %u of %u rated, %llu program violations\n", minWear, maxWear, _profile.endurance, (unsigned long long)_violations);
+    }
+
+    // Programs which tried to set a bit (skipped an erase).  Programs are split at page boundaries like a real driver
+    // would, so page wrap can't happen here.
+    uint64_t violations() {
+        return _violations;
+    }
+
+private:
+    typedef struct {
+        uint64_t start;
+        uint64_t done;
+        bool erase;
+        FlashCallback cb;
+        void *arg;
+    } Pending;
+
+    uint64_t eraseNS() {
+        uint64_t us = 0;
+        int left = ebBytes;
+        while (left >= 65536) {
+            us += _profile.tBE64;
+            left -= 65536;
+        }
+        if (left >= 32768) {
+            us += _profile.tBE32;
+            left -= 32768;
+        }
+        us += (uint64_t)_profile.tSE * ((left + 4095) / 4096);
+        return us * 1000;
+    }
+
+    uint64_t readNS(int size) {
+        return _profile.readSetupNS + (uint64_t)_profile.readNSPerByte * size;
+    }
+
+    // The queued operation executing at the current time, if any
+    Pending *executing() {
+        for (auto &p : _pending) {
+            if (p.done > _now) {
+                return p.start <= _now ? &p : nullptr;
+            }
+        }
+        return nullptr;
+    }
+
+    // Reads wait for the part to go idle, unless they can suspend an in-progress erase.  A suspend pushes back the
+    // erase and everything queued behind it, so their completions in poll() move too.
+    void charge(uint64_t ns, NORSimHistogram *h) {
+        uint64_t start = _now;
+        if (_busyUntil > _now) {
+            Pending *p = executing();
+            if (p && p->erase && _profile.eraseSuspend) {
+                ns += _profile.tSUS * 1000ULL;
+                for (auto &q : _pending) {
+                    if (q.done > _now) {
+                        q.start += (q.start > _now) ? ns : 0;
+                        q.done += ns;
+                    }
+                }
+                _busyUntil += ns;
+            } else {
+                _now = _busyUntil;
+            }
+        }
+        _now += ns;
+        h->add(_now - start);
+    }
+
+    void doErase(int eb) {
+        memset(&_flash[eb * ebBytes], 0xff, ebBytes);
+        _wear[eb]++;
+    }
+
+    uint64_t doProgram(int eb, int offset, const uint8_t *data, int size) {
+        uint8_t *dest = &_flash[eb * ebBytes + offset];
+        uint64_t ns = 0;
+        for (int i = 0; i < size; i++) {
+            if ((dest[i] & data[i]) != data[i]) {
+                _violations++;
+                break;
+            }
+        }
+        // Each page touched is a separate page program command
+        for (int left = size, o = offset; left > 0;) {
+            int len = std::min(left, _profile.pageBytes - (o % _profile.pageBytes));
+            ns += _profile.tPP * 1000ULL;
+            left -= len;
+            o += len;
+        }
+        for (int i = 0; i < size; i++) {
+            dest[i] &= data[i];
+        }
+        return ns;
+    }
+
+    void reportOne(FILE *f, const char *name, NORSimHistogram &h) {
+        fprintf(f, "  %-8s n=%-9zu p50 %9.1f us  p99 %9.1f us  p99.9 %9.1f us  max %9.1f us\n", name, h.count(),
+                h.percentile(50) / 1000.0, h.percentile(99) / 1000.0, h.percentile(99.9) / 1000.0, h.percentile(100) / 1000.0);
+    }
+
+    const int ebBytes;
+    NORFlashProfile _profile;
+    int _flashSize;
+    uint8_t *_flash;
+    uint32_t *_wear;
+    uint64_t _now = 0;
+    uint64_t _busyUntil = 0;
+    uint64_t _violations = 0;
+    std::deque<Pending> _pending;
+    NORSimHistogram _eraseStats;
+    NORSimHistogram _programStats;
+    NORSimHistogram _readStats;
+};
@@ -0,0 +1,98 @@
+/*
+    FlashInterfacePartition - A range of erase blocks in another FlashInterface, for running several FTLs on one part
+
+    Copyright (c) 2024 Earle F. Philhower, III <earlephilhower@yahoo.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program. If not, see https://www.gnu.org/licenses/
+*/
+
+#pragma once
+
+#include "FlashInterface.h"
+
+// Exposes EBs [firstEB, firstEB + ebs) of the parent as EBs [0, ebs).  Partitions never overlap, so FTLs on different
+// partitions can run on different threads as long as the parent allows concurrent calls on different EBs.
+// serialize() and deserialize() cover the whole parent image, so partitions leave them to whoever owns the parent
+// and calls them once for everyone while no partition is in use.
+class FlashInterfacePartition : public FlashInterface {
+public:
+    FlashInterfacePartition(FlashInterface *fi, int firstEB, int ebs) : _fi(fi), _firstEB(firstEB), _ebs(ebs) {
+    }
+
+    virtual ~FlashInterfacePartition() override {
+    }
+
+    virtual int size() override {
+        return _ebs * _fi->eraseBlockSize();
+    }
+
+    virtual int writeBufferSize() override {
+        return _fi->writeBufferSize();
+    }
+
+    virtual int eraseBlockSize() override {
+        return _fi->eraseBlockSize();
+    }
+
+    virtual void serialize() override {
+    }
+
+    virtual void deserialize() override {
+    }
+
+    virtual const uint8_t *readEB(int eb) override {
+        return _fi->readEB(_firstEB + eb);
+    }
+
+    virtual bool eraseBlock(int eb) override {
+        return (eb < _ebs) && _fi->eraseBlock(_firstEB + eb);
+    }
+
+    virtual bool program(int eb, int offset, const void *data, int size) override {
+        return (eb < _ebs) && _fi->program(_firstEB + eb, offset, data, size);
+    }
+
+    virtual bool read(int eb, int offset, void *data, int size) override {
+        return (eb < _ebs) && _fi->read(_firstEB + eb, offset, data, size);
+    }
+
+    virtual bool programv(int eb, const FlashProgramVec *vec, int count) override {
+        return (eb < _ebs) && _fi->programv(_firstEB + eb, vec, count);
+    }
+
+    virtual bool readv(int eb, const FlashReadVec *vec, int count) override {
+        return (eb < _ebs) && _fi->readv(_firstEB + eb, vec, count);
+    }
+
+    virtual bool startErase(int eb, FlashCallback cb, void *arg) override {
+        return (eb < _ebs) && _fi->startErase(_firstEB + eb, cb, arg);
+    }
+
+    virtual bool startProgram(int eb, int offset, const void *data, int size, FlashCallback cb, void *arg) override {
+        return (eb < _ebs) && _fi->startProgram(_firstEB + eb, offset, data, size, cb, arg);
+    }
+
+    virtual int poll() override {
+        return _fi->poll();
+    }
+
+    virtual void setCategory(FlashCategory category) override {
+        _fi->setCategory(category);
+    }
+
+private:
+    FlashInterface *_fi;
+    int _firstEB;
+    int _ebs;
+};
@@ -19,19 +19,31 @@
 
 #pragma once
 
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string>
+
 #include "FlashInterface.h"
 
 // DRAM simulation for host-based testing, NBD, etc.
 class FlashInterfaceRAM : public FlashInterface {
 public:
-    FlashInterfaceRAM(int size) {
+    // The image is saved to `path`, with `path`.tmp and `path`.journal alongside while updating it
+    FlashInterfaceRAM(int size, int ebSize = 4096, const char *path = "flash.bin") : ebBytes(ebSize), imageFile(path) {
+        tempFile = imageFile + ".tmp";
+        journalFile = imageFile + ".journal";
         _flashSize = size;
         _flash = new uint8_t[_flashSize];
         _isErased = new uint8_t[_flashSize / ebBytes];
         bzero(_isErased, _flashSize / ebBytes);
+        _isDirty = new uint8_t[_flashSize / ebBytes];
+        bzero(_isDirty, _flashSize / ebBytes);
+        _fullWrite = true; // Until we've loaded it, we have no idea what's in the image on disk
     }
 
     virtual ~FlashInterfaceRAM() override {
+        delete[] _isDirty;
         delete[] _isErased;
         delete[] _flash;
     }
@@ -44,23 +56,81 @@ public:
         return 128;
     }
 
+    virtual int eraseBlockSize() override {
+        return ebBytes;
+    }
+
     virtual const uint8_t *readEB(int eb) override {
         return &_flash[eb * ebBytes];
     }
 
+    // Only EBs changed since the last save are written back.  They go to a journal first which is replayed on the
+    // next startup if we die while patching the image, so the image on disk is never torn.
     virtual void serialize() override {
-        FILE *f = fopen("flash.bin", "wb");
-        if (f) {
-            fwrite(_flash, 1, _flashSize, f);
-            fclose(f);
+        if (_fullWrite) {
+            writeImage();
+            return;
+        }
+        int ebs = _flashSize / ebBytes;
+        uint32_t dirty = 0;
+        for (int i = 0; i < ebs; i++) {
+            dirty += _isDirty[i] ? 1 : 0;
+        }
+        if (!dirty) {
+            return;
+        }
+
+        // Journal: <magic> <ebBytes> <count> (<eb> <data>)... <commit>
+        FILE *j = fopen(journalFile.c_str(), "wb");
+        if (!j) {
+            return;
+        }
+        uint32_t hdr[2] = {(uint32_t)ebBytes, dirty};
+        bool ok = fwrite(journalMagic, 8, 1, j) == 1;
+        ok = ok && (fwrite(hdr, sizeof(hdr), 1, j) == 1);
+        for (uint32_t i = 0; ok && (i < (uint32_t)ebs); i++) {
+            if (_isDirty[i]) {
+                ok = (fwrite(&i, sizeof(i), 1, j) == 1) && (fwrite(&_flash[i * ebBytes], ebBytes, 1, j) == 1);
+            }
+        }
+        // Commit record only hits the disk after everything before it
+        ok = ok && !fflush(j) && !fsync(fileno(j));
+        ok = ok && (fwrite(journalCommit, 8, 1, j) == 1) && !fflush(j) && !fsync(fileno(j));
+        fclose(j);
+        if (!ok) {
+            unlink(journalFile.c_str());
+            return;
+        }
+
+        int fd = open(imageFile.c_str(), O_WRONLY);
+        if (fd < 0) {
+            // Image vanished, nothing to patch
+            unlink(journalFile.c_str());
+            writeImage();
+            return;
+        }
+        for (int i = 0; ok && (i < ebs); i++) {
+            if (_isDirty[i]) {
+                ok = pwrite(fd, &_flash[i * ebBytes], ebBytes, (off_t)i * ebBytes) == ebBytes;
+            }
+        }
+        ok = ok && !fsync(fd);
+        close(fd);
+        if (ok) {
+            unlink(journalFile.c_str());
+            bzero(_isDirty, ebs);
         }
     }
 
     virtual void deserialize() override {
-        FILE *f = fopen("flash.bin", "rb");
+        replayJournal();
+        FILE *f = fopen(imageFile.c_str(), "rb");
         if (f) {
-            if (fread(_flash, 1, _flashSize, f) != _flashSize) {
+            if (fread(_flash, 1, _flashSize, f) != (size_t)_flashSize) {
                 bzero(_flash, _flashSize);
+            } else {
+                _fullWrite = false;
+                bzero(_isDirty, _flashSize / ebBytes);
             }
             fclose(f);
         }
@@ -75,6 +145,7 @@ public:
         }
         _isErased[eb] = 1;
         if (eb < _flashSize / ebBytes) {
+            _isDirty[eb] = 1;
             bzero(&_flash[eb * ebBytes], ebBytes);
             return true;
         }
@@ -84,6 +155,7 @@ public:
     virtual bool program(int eb, int offset, const void *data, int size) override {
         if (eb < _flashSize / ebBytes) {
             _isErased[eb] = 0;
+            _isDirty[eb] = 1;
             memcpy(&_flash[eb * ebBytes + offset], data, size);
             return true;
         }
@@ -98,9 +170,90 @@ public:
         return false;
     }
 
+    virtual bool programv(int eb, const FlashProgramVec *vec, int count) override {
+        if (eb < _flashSize / ebBytes) {
+            _isErased[eb] = 0;
+            _isDirty[eb] = 1;
+            for (int i = 0; i < count; i++) {
+                memcpy(&_flash[eb * ebBytes + vec[i].offset], vec[i].data, vec[i].size);
+            }
+            return true;
+        }
+        return false;
+    }
+
+    virtual bool readv(int eb, const FlashReadVec *vec, int count) override {
+        if (eb < _flashSize / ebBytes) {
+            for (int i = 0; i < count; i++) {
+                memcpy(vec[i].data, &_flash[eb * ebBytes + vec[i].offset], vec[i].size);
+            }
+            return true;
+        }
+        return false;
+    }
+
 private:
-    const int ebBytes = 4096;
+    // New (or wrong-sized) images are written to a temp file and renamed over the old one
+    void writeImage() {
+        FILE *f = fopen(tempFile.c_str(), "wb");
+        if (!f) {
+            return;
+        }
+        bool ok = (fwrite(_flash, 1, _flashSize, f) == (size_t)_flashSize) && !fflush(f) && !fsync(fileno(f));
+        fclose(f);
+        if (ok && !rename(tempFile.c_str(), imageFile.c_str())) {
+            unlink(journalFile.c_str()); // Anything in it is older than this image
+            _fullWrite = false;
+            bzero(_isDirty, _flashSize / ebBytes);
+        } else {
+            unlink(tempFile.c_str());
+        }
+    }
+
+    // A journal without its commit record never touched the image, so it's simply dropped.  A committed one is kept
+    // until it has been fully written into the image, so a failed replay is retried next time.
+    void replayJournal() {
+        FILE *j = fopen(journalFile.c_str(), "rb");
+        if (!j) {
+            return;
+        }
+        char magic[8];
+        uint32_t hdr[2];
+        bool ok = (fread(magic, 8, 1, j) == 1) && !memcmp(magic, journalMagic, 8);
+        ok = ok && (fread(hdr, sizeof(hdr), 1, j) == 1) && (hdr[0] == (uint32_t)ebBytes);
+        long len = ok ? (long)(8 + sizeof(hdr) + hdr[1] * (sizeof(uint32_t) + ebBytes)) : 0;
+        bool committed = ok && !fseek(j, len, SEEK_SET) && (fread(magic, 8, 1, j) == 1) && !memcmp(magic, journalCommit, 8);
+        int fd = committed ? open(imageFile.c_str(), O_WRONLY) : -1;
+        ok = fd >= 0;
+        if (ok) {
+            fseek(j, 8 + sizeof(hdr), SEEK_SET);
+            uint8_t *buff = new uint8_t[ebBytes];
+            for (uint32_t i = 0; ok && (i < hdr[1]); i++) {
+                uint32_t eb;
+                ok = (fread(&eb, sizeof(eb), 1, j) == 1) && (fread(buff, ebBytes, 1, j) == 1);
+                ok = ok && (eb < (uint32_t)(_flashSize / ebBytes)); // Never write outside the image
+                ok = ok && (pwrite(fd, buff, ebBytes, (off_t)eb * ebBytes) == ebBytes);
+            }
+            delete[] buff;
+            ok = ok && !fsync(fd);
+            close(fd);
+        }
+        fclose(j);
+        if (!committed || ok) {
+            unlink(journalFile.c_str());
+        }
+    }
+
+    const int ebBytes;
     int _flashSize;
     uint8_t *_flash;
     uint8_t *_isErased;
+    uint8_t *_isDirty;
+    bool _fullWrite;
+
+    std::string imageFile;
+    std::string tempFile;
+    std::string journalFile;
+    const char journalMagic[8] = {'S', 'P', 'I', 'F', 'T', 'L', 'J', '0'};
+    const char journalCommit[8] = {'S', 'P', 'I', 'F', 'T', 'L', 'J', 'C'};
 };
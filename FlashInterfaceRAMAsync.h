@@ -0,0 +1,186 @@
+/*
+    FlashInterfaceRAMAsync.h - Host flash emulation with real latencies and a worker thread
+
+    Copyright (c) 2024 Earle F. Philhower, III <earlephilhower@yahoo.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program. If not, see https://www.gnu.org/licenses/
+*/
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "FlashInterfaceRAM.h"
+
+// DRAM simulation where erases and programs take as long as they would on a real part.  Asynchronous operations
+// are executed in order by a worker thread, like a flash chip with a command queue, so FTL overlap can be measured.
+class FlashInterfaceRAMAsync : public FlashInterfaceRAM {
+public:
+    FlashInterfaceRAMAsync(int size, int eraseUS = 45000, int programUSPerPage = 400, int ebSize = 4096) : FlashInterfaceRAM(size, ebSize) {
+        _eraseUS = eraseUS;
+        _programUSPerPage = programUSPerPage;
+        _worker = std::thread(&FlashInterfaceRAMAsync::work, this);
+    }
+
+    virtual ~FlashInterfaceRAMAsync() override {
+        {
+            std::unique_lock<std::mutex> l(_mutex);
+            _exit = true;
+        }
+        _cv.notify_all();
+        _worker.join();
+    }
+
+    virtual void serialize() override {
+        waitIdle();
+        FlashInterfaceRAM::serialize();
+    }
+
+    virtual void deserialize() override {
+        waitIdle();
+        FlashInterfaceRAM::deserialize();
+    }
+
+    virtual bool eraseBlock(int eb) override {
+        waitIdle();
+        busy(_eraseUS);
+        return FlashInterfaceRAM::eraseBlock(eb);
+    }
+
+    virtual bool program(int eb, int offset, const void *data, int size) override {
+        waitIdle();
+        busy(programUS(size));
+        return FlashInterfaceRAM::program(eb, offset, data, size);
+    }
+
+    virtual bool programv(int eb, const FlashProgramVec *vec, int count) override {
+        waitIdle();
+        for (int i = 0; i < count; i++) {
+            busy(programUS(vec[i].size));
+        }
+        return FlashInterfaceRAM::programv(eb, vec, count);
+    }
+
+    virtual bool read(int eb, int offset, void *data, int size) override {
+        waitIdle();
+        return FlashInterfaceRAM::read(eb, offset, data, size);
+    }
+
+    virtual bool readv(int eb, const FlashReadVec *vec, int count) override {
+        waitIdle();
+        return FlashInterfaceRAM::readv(eb, vec, count);
+    }
+
+    virtual bool startErase(int eb, FlashCallback cb, void *arg) override {
+        return queue({true, eb, 0, nullptr, 0, cb, arg, false});
+    }
+
+    virtual bool startProgram(int eb, int offset, const void *data, int size, FlashCallback cb, void *arg) override {
+        return queue({false, eb, offset, data, size, cb, arg, false});
+    }
+
+    virtual int poll() override {
+        std::deque<Op> done;
+        int outstanding;
+        {
+            std::unique_lock<std::mutex> l(_mutex);
+            done.swap(_done);
+            outstanding = _queue.size() + (_running ? 1 : 0);
+        }
+        if (done.empty() && outstanding) {
+            std::this_thread::yield(); // We're being spun on, let the worker finish
+        }
+        for (auto &op : done) {
+            if (op.cb) {
+                op.cb(op.arg, op.ok);
+            }
+        }
+        return outstanding;
+    }
+
+private:
+    typedef struct {
+        bool erase;
+        int eb;
+        int offset;
+        const void *data;
+        int size;
+        FlashCallback cb;
+        void *arg;
+        bool ok;
+    } Op;
+
+    int programUS(int size) {
+        return _programUSPerPage * ((size + 255) / 256);
+    }
+
+    void busy(int us) {
+        std::this_thread::sleep_for(std::chrono::microseconds(us));
+    }
+
+    bool queue(Op op) {
+        {
+            std::unique_lock<std::mutex> l(_mutex);
+            _queue.push_back(op);
+        }
+        _cv.notify_all();
+        return true;
+    }
+
+    // Completed operations stay pending until poll() reports them, but synchronous calls only need the flash idle
+    void waitIdle() {
+        std::unique_lock<std::mutex> l(_mutex);
+        _cv.wait(l, [this] { return _queue.empty() && !_running; });
+    }
+
+    void work() {
+        std::unique_lock<std::mutex> l(_mutex);
+        while (true) {
+            _cv.wait(l, [this] { return _exit || !_queue.empty(); });
+            if (_queue.empty()) {
+                return; // _exit, and all work is complete
+            }
+            Op op = _queue.front();
+            _queue.pop_front();
+            _running = true;
+            l.unlock();
+            if (op.erase) {
+                busy(_eraseUS);
+                op.ok = FlashInterfaceRAM::eraseBlock(op.eb);
+            } else {
+                busy(programUS(op.size));
+                FlashProgramVec vec = {op.offset, op.data, op.size};
+                op.ok = FlashInterfaceRAM::programv(op.eb, &vec, 1);
+            }
+            l.lock();
+            _running = false;
+            _done.push_back(op);
+            _cv.notify_all();
+        }
+    }
+
+    int _eraseUS;
+    int _programUSPerPage;
+    std::thread _worker;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<Op> _queue;
+    std::deque<Op> _done;
+    bool _running = false;
+    bool _exit = false;
+};
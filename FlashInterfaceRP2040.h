@@ -26,7 +26,8 @@
 
 class FlashInterfaceRP2040 : public FlashInterface {
 public:
-    FlashInterfaceRP2040(const uint8_t *start, const uint8_t *end) {
+    // ebSize is a multiple of 4096.  The SDK will use the faster 64KB block erase command when aligned
+    FlashInterfaceRP2040(const uint8_t *start, const uint8_t *end, int ebSize = 4096) : ebBytes(ebSize) {
         _flashSize = end - start;
         _flash = start;
     }
@@ -43,6 +44,10 @@ public:
         return 256;
     }
 
+    virtual int eraseBlockSize() override {
+        return ebBytes;
+    }
+
     virtual const uint8_t *readEB(int eb) override {
         return &_flash[eb * ebBytes];
     }
@@ -73,6 +78,28 @@ public:
         return false;
     }
 
+    // Stops the other core and IRQs once per piece rather than per page, but lets them run between pieces since a
+    // batch can cover a whole EB.  XIP is restored after each flash_range_program so sources in flash can still be
+    // copied to RAM between pages.
+    virtual bool programv(int eb, const FlashProgramVec *vec, int count) override {
+        if (eb < _flashSize / ebBytes) {
+            uint8_t buff[256];
+            for (int i = 0; i < count; i++) {
+                const uint8_t *addr = _flash + (eb * ebBytes + vec[i].offset);
+                noInterrupts();
+                rp2040.idleOtherCore();
+                for (int j = 0; j < vec[i].size; j += sizeof(buff)) {
+                    memcpy(buff, (const uint8_t *)vec[i].data + j, sizeof(buff));
+                    flash_range_program((intptr_t)addr + j - (intptr_t)XIP_BASE, buff, sizeof(buff));
+                }
+                rp2040.resumeOtherCore();
+                interrupts();
+            }
+            return true;
+        }
+        return false;
+    }
+
     virtual bool read(int eb, int offset, void *data, int size) override {
         if (eb < _flashSize / ebBytes) {
             memcpy(data, _flash + (eb * ebBytes + offset), size);
@@ -82,7 +109,7 @@ public:
     }
 
 private:
-    const int ebBytes = 4096;
+    const int ebBytes;
     int _flashSize;
     const uint8_t *_flash;
 };
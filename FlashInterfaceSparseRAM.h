@@ -0,0 +1,129 @@
+/*
+    FlashInterfaceSparseRAM.h - Sparse host flash emulation for very large simulated devices
+
+    Copyright (c) 2024 Earle F. Philhower, III <earlephilhower@yahoo.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program. If not, see https://www.gnu.org/licenses/
+*/
+
+#pragma once
+
+#include "FlashInterface.h"
+
+// DRAM simulation which only allocates an EB when it is first programmed and frees it again on erase.  Untouched
+// EBs all read back from one shared erased (all 0s, like FlashInterfaceRAM) page.  Memory only, nothing is saved,
+// so it's meant for scaling benchmarks and tests which build lots of devices.
+class FlashInterfaceSparseRAM : public FlashInterface {
+public:
+    FlashInterfaceSparseRAM(int size, int ebSize = 4096) : ebBytes(ebSize) {
+        _flashSize = size;
+        _eb = new uint8_t *[_flashSize / ebBytes];
+        bzero(_eb, sizeof(uint8_t *) * (_flashSize / ebBytes));
+        _erased = new uint8_t[ebBytes];
+        bzero(_erased, ebBytes);
+        _allocated = 0;
+    }
+
+    virtual ~FlashInterfaceSparseRAM() override {
+        for (int i = 0; i < _flashSize / ebBytes; i++) {
+            delete[] _eb[i];
+        }
+        delete[] _erased;
+        delete[] _eb;
+    }
+
+    virtual int size() override {
+        return _flashSize;
+    }
+
+    virtual int writeBufferSize() override {
+        return 128;
+    }
+
+    virtual int eraseBlockSize() override {
+        return ebBytes;
+    }
+
+    virtual const uint8_t *readEB(int eb) override {
+        return _eb[eb] ? _eb[eb] : _erased;
+    }
+
+    virtual bool eraseBlock(int eb) override {
+        if (eb >= _flashSize / ebBytes) {
+            return false;
+        }
+        if (_eb[eb]) {
+            delete[] _eb[eb];
+            _eb[eb] = nullptr;
+            _allocated--;
+        }
+        return true;
+    }
+
+    virtual bool program(int eb, int offset, const void *data, int size) override {
+        uint8_t *p = page(eb);
+        if (!p) {
+            return false;
+        }
+        memcpy(p + offset, data, size);
+        return true;
+    }
+
+    virtual bool programv(int eb, const FlashProgramVec *vec, int count) override {
+        uint8_t *p = page(eb);
+        if (!p) {
+            return false;
+        }
+        for (int i = 0; i < count; i++) {
+            memcpy(p + vec[i].offset, vec[i].data, vec[i].size);
+        }
+        return true;
+    }
+
+    virtual bool read(int eb, int offset, void *data, int size) override {
+        if (eb >= _flashSize / ebBytes) {
+            return false;
+        }
+        memcpy(data, readEB(eb) + offset, size);
+        return true;
+    }
+
+    // Host memory used to hold the image, including the page table
+    size_t residentBytes() {
+        return (size_t)_allocated * ebBytes + ebBytes + sizeof(uint8_t *) * (_flashSize / ebBytes);
+    }
+
+    int allocatedEBs() {
+        return _allocated;
+    }
+
+private:
+    uint8_t *page(int eb) {
+        if (eb >= _flashSize / ebBytes) {
+            return nullptr;
+        }
+        if (!_eb[eb]) {
+            _eb[eb] = new uint8_t[ebBytes];
+            bzero(_eb[eb], ebBytes);
+            _allocated++;
+        }
+        return _eb[eb];
+    }
+
+    const int ebBytes;
+    int _flashSize;
+    uint8_t **_eb;
+    uint8_t *_erased;
+    int _allocated;
+};
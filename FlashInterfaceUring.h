@@ -0,0 +1,341 @@
+/*
+    FlashInterfaceUring.h - Host flash emulation on a file using Linux io_uring
+
+    Copyright (c) 2024 Earle F. Philhower, III <earlephilhower@yahoo.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program. If not, see https://www.gnu.org/licenses/
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/falloc.h>
+#include <linux/io_uring.h>
+#include <algorithm>
+#include <vector>
+
+#include "FlashInterface.h"
+
+// File-backed simulation which queues erases (hole punches) and programs (writes) to the kernel through an io_uring,
+// submitting and reaping them in batches from poll().  Use it with SPIFTL::setPipelineDepth() so the FTL, and not
+// syscall overhead, limits emulated throughput.  Talks to the kernel directly, so no liburing is needed.  An existing
+// image must already be `size` bytes, so a mistyped size can't truncate it.
+class FlashInterfaceUring : public FlashInterface {
+public:
+    FlashInterfaceUring(const char *path, int size, int ebSize = 4096, unsigned entries = 64) : ebBytes(ebSize) {
+        _flashSize = 0;
+        _ring = -1;
+        _fd = open(path, O_RDWR | O_CREAT, 0644);
+        struct stat st;
+        if ((_fd < 0) || fstat(_fd, &st) || (!st.st_size && ftruncate(_fd, size))) {
+            perror("FlashInterfaceUring: open");
+            return;
+        }
+        if (st.st_size && (st.st_size != size)) {
+            fprintf(stderr, "FlashInterfaceUring: %s is %lld bytes, not %d\n", path, (long long)st.st_size, size);
+            return;
+        }
+        struct io_uring_params p;
+        bzero(&p, sizeof(p));
+        _ring = syscall(__NR_io_uring_setup, entries, &p);
+        if (_ring < 0) {
+            perror("FlashInterfaceUring: io_uring_setup");
+            return;
+        }
+        _sqMapSize = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+        _cqMapSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) {
+            _sqMapSize = _cqMapSize = std::max(_sqMapSize, _cqMapSize);
+        }
+        _sqMap = (uint8_t *)mmap(nullptr, _sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_SQ_RING);
+        _cqMap = single ? _sqMap : (uint8_t *)mmap(nullptr, _cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_CQ_RING);
+        _sqes = (struct io_uring_sqe *)mmap(nullptr, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_SQES);
+        if ((_sqMap == MAP_FAILED) || (_cqMap == MAP_FAILED) || (_sqes == MAP_FAILED)) {
+            perror("FlashInterfaceUring: mmap");
+            return;
+        }
+        _sqEntries = p.sq_entries;
+        _sqTail = (unsigned *)(_sqMap + p.sq_off.tail);
+        _sqLocalTail = *_sqTail;
+        _sqMask = *(unsigned *)(_sqMap + p.sq_off.ring_mask);
+        _sqArray = (unsigned *)(_sqMap + p.sq_off.array);
+        _cqHead = (unsigned *)(_cqMap + p.cq_off.head);
+        _cqTail = (unsigned *)(_cqMap + p.cq_off.tail);
+        _cqMask = *(unsigned *)(_cqMap + p.cq_off.ring_mask);
+        _cqes = (struct io_uring_cqe *)(_cqMap + p.cq_off.cqes);
+
+        _cache = new uint8_t[ebBytes];
+        _cacheEB = -1;
+        _flashSize = size;
+    }
+
+    virtual ~FlashInterfaceUring() override {
+        if (_flashSize) {
+            waitAll();
+            for (auto op : _done) {
+                delete[] op->buff;
+                delete op;
+            }
+            munmap(_sqes, _sqEntries * sizeof(struct io_uring_sqe));
+            if (_cqMap != _sqMap) {
+                munmap(_cqMap, _cqMapSize);
+            }
+            munmap(_sqMap, _sqMapSize);
+            delete[] _cache;
+        }
+        if (_ring >= 0) {
+            close(_ring);
+        }
+        if (_fd >= 0) {
+            close(_fd);
+        }
+    }
+
+    // 0 if the file or ring could not be set up
+    virtual int size() override {
+        return _flashSize;
+    }
+
+    virtual int writeBufferSize() override {
+        return 128;
+    }
+
+    virtual int eraseBlockSize() override {
+        return ebBytes;
+    }
+
+    // The last EB read is cached.  Pending erases and programs are applied to the cache when started, so the pointer
+    // always reflects the flash as the FTL sees it, but it is only valid until the next readEB() call.
+    virtual const uint8_t *readEB(int eb) override {
+        if (eb != _cacheEB) {
+            waitAll();
+            _cacheEB = -1;
+            if (pread(_fd, _cache, ebBytes, (off_t)eb * ebBytes) == ebBytes) {
+                _cacheEB = eb;
+            } else {
+                bzero(_cache, ebBytes);
+            }
+        }
+        return _cache;
+    }
+
+    virtual void serialize() override {
+        waitAll();
+        fdatasync(_fd);
+    }
+
+    virtual void deserialize() override {
+        // The file is the image, nothing to do
+    }
+
+    virtual bool eraseBlock(int eb) override {
+        waitAll();
+        return startErase(eb, nullptr, nullptr) && waitAll();
+    }
+
+    virtual bool program(int eb, int offset, const void *data, int size) override {
+        waitAll();
+        return startProgram(eb, offset, data, size, nullptr, nullptr) && waitAll();
+    }
+
+    virtual bool programv(int eb, const FlashProgramVec *vec, int count) override {
+        waitAll();
+        for (int i = 0; i < count; i++) {
+            if (!startProgram(eb, vec[i].offset, vec[i].data, vec[i].size, nullptr, nullptr)) {
+                return false;
+            }
+        }
+        return waitAll();
+    }
+
+    virtual bool read(int eb, int offset, void *data, int size) override {
+        if (eb >= _flashSize / ebBytes) {
+            return false;
+        }
+        if (eb == _cacheEB) {
+            memcpy(data, _cache + offset, size);
+            return true;
+        }
+        waitAll();
+        return pread(_fd, data, size, (off_t)eb * ebBytes + offset) == size;
+    }
+
+    virtual bool startErase(int eb, FlashCallback cb, void *arg) override {
+        if (eb >= _flashSize / ebBytes) {
+            return false;
+        }
+        if (eb == _cacheEB) {
+            bzero(_cache, ebBytes);
+        }
+        // Holes read back as 0s, same as FlashInterfaceRAM's erased state, and keep the image sparse
+        Op *op = new Op{eb, 0, ebBytes, nullptr, cb, arg, false};
+        struct io_uring_sqe *sqe = queue(op);
+        sqe->opcode = IORING_OP_FALLOCATE;
+        sqe->off = (uint64_t)eb * ebBytes;
+        sqe->addr = ebBytes;
+        sqe->len = FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
+        return true;
+    }
+
+    // Data is copied when started, so the caller (and readEB() cache) are free to change right away
+    virtual bool startProgram(int eb, int offset, const void *data, int size, FlashCallback cb, void *arg) override {
+        if (eb >= _flashSize / ebBytes) {
+            return false;
+        }
+        Op *op = new Op{eb, offset, size, new uint8_t[size], cb, arg, false};
+        memcpy(op->buff, data, size);
+        if (eb == _cacheEB) {
+            memcpy(_cache + offset, data, size);
+        }
+        struct io_uring_sqe *sqe = queue(op);
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->off = (uint64_t)eb * ebBytes + offset;
+        sqe->addr = (uint64_t)op->buff;
+        sqe->len = size;
+        return true;
+    }
+
+    virtual int poll() override {
+        enter(0);
+        reap();
+        std::vector<Op *> done;
+        done.swap(_done);
+        for (auto op : done) {
+            if (op->cb) {
+                op->cb(op->arg, op->ok);
+            }
+            delete[] op->buff;
+            delete op;
+        }
+        return _inflight.size();
+    }
+
+private:
+    typedef struct {
+        int eb;
+        int offset;
+        int size;
+        uint8_t *buff;
+        FlashCallback cb;
+        void *arg;
+        bool ok;
+    } Op;
+
+    // The kernel is free to run queued requests in any order, so anything overlapping an in-flight request
+    // (i.e. programs right after an erase of the same EB) waits for everything before it to complete.
+    struct io_uring_sqe *queue(Op *op) {
+        while (_inflight.size() >= _sqEntries) {
+            enter(1);
+            reap();
+        }
+        bool overlaps = false;
+        for (auto o : _inflight) {
+            if ((o->eb == op->eb) && (o->offset < op->offset + op->size) && (op->offset < o->offset + o->size)) {
+                overlaps = true;
+                break;
+            }
+        }
+        _inflight.push_back(op);
+        unsigned idx = _sqLocalTail++ & _sqMask;
+        struct io_uring_sqe *sqe = &_sqes[idx];
+        bzero(sqe, sizeof(*sqe));
+        sqe->fd = _fd;
+        sqe->flags = overlaps ? IOSQE_IO_DRAIN : 0;
+        sqe->user_data = (uint64_t)op;
+        _sqArray[idx] = idx;
+        _unsubmitted++;
+        return sqe;
+    }
+
+    // Submit anything queued and optionally block for completions
+    void enter(unsigned minComplete) {
+        if (!_unsubmitted && !minComplete) {
+            return;
+        }
+        __atomic_store_n(_sqTail, _sqLocalTail, __ATOMIC_RELEASE); // SQEs are only visible to the kernel once complete
+        int ret = syscall(__NR_io_uring_enter, _ring, _unsubmitted, minComplete, minComplete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        if (ret > 0) {
+            _unsubmitted -= ret;
+        }
+    }
+
+    void reap() {
+        unsigned head = *_cqHead;
+        unsigned tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe *cqe = &_cqes[head & _cqMask];
+            Op *op = (Op *)cqe->user_data;
+            op->ok = op->buff ? (cqe->res == op->size) : (cqe->res == 0);
+            for (size_t i = 0; i < _inflight.size(); i++) {
+                if (_inflight[i] == op) {
+                    _inflight.erase(_inflight.begin() + i);
+                    break;
+                }
+            }
+            if (op->cb) {
+                _done.push_back(op);
+            } else {
+                // Synchronous, the caller only cares if it worked
+                _syncFailed |= !op->ok;
+                delete[] op->buff;
+                delete op;
+            }
+            head++;
+        }
+        __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    // Asynchronous completions are still reported to their callbacks from poll().  Returns false if any synchronous
+    // operation since the last call failed.
+    bool waitAll() {
+        while (!_inflight.empty()) {
+            enter(1);
+            reap();
+        }
+        bool ok = !_syncFailed;
+        _syncFailed = false;
+        return ok;
+    }
+
+    const int ebBytes;
+    int _flashSize;
+    int _fd;
+    int _ring;
+    size_t _sqMapSize;
+    size_t _cqMapSize;
+    uint8_t *_sqMap;
+    uint8_t *_cqMap;
+    struct io_uring_sqe *_sqes;
+    unsigned _sqEntries;
+    unsigned *_sqTail;
+    unsigned _sqLocalTail;
+    unsigned _sqMask;
+    unsigned *_sqArray;
+    unsigned *_cqHead;
+    unsigned *_cqTail;
+    unsigned _cqMask;
+    struct io_uring_cqe *_cqes;
+    unsigned _unsubmitted = 0;
+    bool _syncFailed = false;
+    std::vector<Op *> _inflight;
+    std::vector<Op *> _done;
+    uint8_t *_cache;
+    int _cacheEB;
+};
@@ -35,26 +35,178 @@
 #define FTL_DEBUG 0
 #endif
 
+// Per-operation latency histograms, ~2KB of RAM and two clock reads per call when enabled
+#ifndef FTL_HISTOGRAMS
+#define FTL_HISTOGRAMS 0
+#endif
+
+// Binary ring buffer of recent FTL decisions, 16 bytes per entry.  Cheap enough to leave on in production.
+#ifndef FTL_TRACE
+#define FTL_TRACE 0
+#endif
+#ifndef FTL_TRACE_ENTRIES
+#define FTL_TRACE_ENTRIES 256 // Power of 2
+#endif
+
+// Allow read() from any number of threads while a single thread at a time calls everything else.  Readers retry if
+// an erase happened while they were looking, so only synchronous flash (pipeline depth 0) is supported.
+#ifndef FTL_CONCURRENT_READS
+#define FTL_CONCURRENT_READS 0
+#endif
+#if FTL_CONCURRENT_READS
+#include <atomic>
+#endif
+
+// Microsecond clock for statistics, override to use your own
+#ifndef FTL_MICROS
+#ifdef ARDUINO
+#define FTL_MICROS() micros()
+#else
+#include <time.h>
+static inline uint32_t ftlMicros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+#define FTL_MICROS() ftlMicros()
+#endif
+#endif
+
+// Snapshot of FTL state and cumulative counters since construction, from SPIFTL::getStats()
+typedef struct {
+    // Current state
+    int emptyEBs;
+    int validLBAs;
+    int highestPECount;
+    int peCountOffset;
+    int metadataAge;
+    // Cumulative
+    uint32_t hostWrites;
+    uint32_t hostReads;
+    uint32_t hostTrims;
+    uint32_t gcRuns;                        // garbageCollect() calls
+    uint32_t gcRelocated;                   // LBAs moved by GC
+    uint32_t erases[FlashCategories];       // By cause
+    uint32_t persists;
+    uint32_t metaAgeMoves;                  // Metadata EBs moved by metaAgeRewrite()
+    uint32_t gcStalls;                      // Host writes which had to wait for GC
+    uint32_t gcStallMaxUS;
+    uint32_t gcStallAvgUS;
+} SPIFTLStats;
+
+// Public calls timed by FTL_HISTOGRAMS
+typedef enum {
+    FTLOpWrite = 0,
+    FTLOpRead,
+    FTLOpTrim,
+    FTLOpPersist,
+    FTLOpStart,
+    FTLOps
+} FTLOp;
+
+// Each op is split by what else had to happen inside the call, OR'd together
+enum {
+    FTLVariantGC = 1,
+    FTLVariantPersist = 2,
+    FTLVariants = 4
+};
+
+// Log2 latency buckets, bucket[0] is < 1us and bucket[n] is [2^(n-1), 2^n) us
+typedef struct {
+    uint32_t bucket[24];
+    uint32_t count;
+    uint32_t maxUS;
+
+    // Upper bound of the bucket holding the p-th percentile sample
+    uint32_t percentileUS(float p) const {
+        uint32_t want = (uint32_t)(count * p / 100.0f);
+        uint32_t sum = 0;
+        for (int i = 0; i < 24; i++) {
+            sum += bucket[i];
+            if (sum > want) {
+                return i ? 1U << i : 1;
+            }
+        }
+        return maxUS;
+    }
+} FTLHistogram;
+
+// FTL_TRACE events and their arguments.  Append only, tracedecode.cpp knows these by number.
+typedef enum {
+    FTLTraceFormat = 0,     // -
+    FTLTraceFormatErase,    // b=eb
+    FTLTraceStart,          // b=epoch restored
+    FTLTraceWrite,          // a=lba, b=eb, c=idx
+    FTLTraceTrim,           // a=lba, b=eb, c=idx
+    FTLTraceFreeEB,         // b=eb
+    FTLTraceErase,          // b=eb, c=pe count before
+    FTLTraceSelectEB,       // b=eb
+    FTLTraceGC,             // a=score, b=src eb, c=dest eb
+    FTLTraceGCMove,         // a=lba, b=dest eb, c=idx
+    FTLTracePersist,        // b=epoch
+    FTLTraceMetaFree,       // b=eb
+    FTLTraceMetaAlloc,      // b=eb
+    FTLTraceMetaAge,        // b=old eb, c=new eb
+    FTLTraceEvents
+} FTLTraceEvent;
+
+typedef struct {
+    uint32_t us;            // FTL_MICROS() timestamp
+    uint16_t event;
+    uint16_t a;
+    uint32_t b;
+    uint32_t c;
+} FTLTraceEntry;
+
+// Header for dumpTrace() output, followed by `count` entries oldest first
+typedef struct {
+    char sig[8];            // "FTLTRC01"
+    uint32_t entrySize;
+    uint32_t count;
+    uint32_t total;         // Events since startup, total - count were overwritten
+} FTLTraceHeader;
 
 class SPIFTL {
 public:
-    SPIFTL(FlashInterface *fi) : _fi(fi) {
+    // Erase block size comes from the FlashInterface, LBA size may be any power of 2 from 512 to the EB size as long as
+    // there are under 255 LBAs per EB (i.e. at most 128, so a 128KB EB needs LBAs of 1KB or more)
+    SPIFTL(FlashInterface *fi, int lbaSize = 512) : ebBytes(fi->eraseBlockSize()), lbaBytes(lbaSize), _fi(fi) {
         flashBytes = fi->size();
-        assert(flashBytes <= 16 * 1024 * 1024); // We assume 16MB or less flash space with certain bitfields
+        assert((lbaBytes >= 512) && (lbaBytes <= ebBytes) && !(lbaBytes & (lbaBytes - 1)));
+        assert(!(ebBytes % lbaBytes));
+        assert(flashBytes / lbaBytes <= 1 << 15); // L2P entries only have 15 bits of EB+index
         eraseBlocks = flashBytes / ebBytes;
+        lbasPerEB = ebBytes / lbaBytes;
+        assert(lbasPerEB < 0xff); // ebState counts valid LBAs in a byte, with 0xff marking metadata EBs
+        for (l2pIdxBits = 0; (1 << l2pIdxBits) < lbasPerEB; l2pIdxBits++) {
+            /* log2 */
+        }
+        l2pEBBits = 15 - l2pIdxBits;
+        // Only differs from the 1 << 15 check above when the EB isn't a power of 2 and the index field is partly unused
+        assert(eraseBlocks <= 1 << l2pEBBits);
+        // Under 15 LBAs/EB (nibble 0x0f marks metadata) lets us pack 2 EB states per byte, otherwise we need a full byte
+        wideEBState = lbasPerEB >= 0x0f;
+        ebMeta = wideEBState ? 0xff : 0x0f;
+        ebStateBytes = wideEBState ? eraseBlocks : (eraseBlocks + 1) / 2;
         int theoreticalLBAs = eraseBlocks * ebBytes / lbaBytes;
-        metaEBBytes = /* peCount */ eraseBlocks + /* ebState */ (eraseBlocks + 1) / 2 + /* l2p */ (theoreticalLBAs * 2) + /* peCountOffset */ 4;
+        metaEBBytes = /* peCount */ eraseBlocks + /* ebState */ ebStateBytes + /* l2p */ (theoreticalLBAs * 2) + /* peCountOffset */ 4;
         metaEBs = 2 * (1 + metaEBBytes / (ebBytes - 64 /* header/footer/checksums */));
-        flashLBAs = (eraseBlocks - 3 /* required for GC */ - metaEBs) * (ebBytes / lbaBytes);
+        flashLBAs = (eraseBlocks - 3 /* required for GC */ - metaEBs) * lbasPerEB;
         flashWriteBufferSize = fi->writeBufferSize();
+        assert(!(lbaBytes % flashWriteBufferSize)); // Host data goes out in writeBufferSize() pieces
         peCount = new uint8_t[eraseBlocks];
-        ebState = new uint8_t[(eraseBlocks + 1) / 2];
+        ebState = new uint8_t[ebStateBytes];
         metaEBList = new int16_t[metaEBs];
         l2p = new L2P[flashLBAs];
+        mappedCount = new uint8_t[(flashLBAs + extentGroupLBAs - 1) / extentGroupLBAs];
+        gcMoved = new uint16_t[lbasPerEB];
         metadataEBList.reserve(metaEBs); // Guarantee it can fit the list and avoid any memory allocations during FTL persistence
     };
 
     ~SPIFTL() {
+        setPipelineDepth(0);
+        delete[] gcMoved;
+        delete[] mappedCount;
         delete[] l2p;
         delete[] metaEBList;
         delete[] ebState;
@@ -78,15 +230,20 @@ public:
     }
 
     bool format() {
-#if FTL_DEBUG
-        printf("formatting FTL\n");
+#if FTL_TRACE
+        trace(FTLTraceFormat);
 #endif
+        drain();
+        openEB = -1;
+        openEBNextIndex = 0;
         bzero(l2p, sizeof(L2P) * flashLBAs);
+        bzero(mappedCount, (flashLBAs + extentGroupLBAs - 1) / extentGroupLBAs);
         bzero(peCount, sizeof(uint8_t) * eraseBlocks);
-        bzero(ebState, sizeof(uint8_t) * ((eraseBlocks + 1) / 2));
+        bzero(ebState, sizeof(uint8_t) * ebStateBytes);
         peCountOffset = 0;
         highestPECount = 0;
         emptyEBs = eraseBlocks;
+        validLBAs = 0;
         for (int i = 0; i < metaEBs; i++) {
             emptyEBs--;
             setEBMeta(i);
@@ -94,15 +251,18 @@ public:
         }
         metadataAge = 0;
         // Blow away anything that looks like old metadata!
+        FlashCategory cat = setFlashCategory(FlashCategoryMetaPersist);
         for (int i = 0; i < eraseBlocks; i++) {
             const uint8_t *eb = _fi->readEB(i);
             if (!memcmp(eb, metadataSig, 8)) {
-#if FTL_DEBUG
-                printf("format erasing eb %d\n", i);
+#if FTL_TRACE
+                trace(FTLTraceFormatErase, 0, i);
 #endif
+                stats.erases[flashCategory]++;
                 _fi->eraseBlock(i);
             }
         }
+        setFlashCategory(cat);
         return true;
     }
 
@@ -113,7 +273,7 @@ public:
         int metas = 0;
         bool ret = true;
         for (int i = 0; i < eraseBlocks; i++) {
-            c += !getEBState(i) ? 1 : 0;
+            c += (!getEBState(i) && (i != openEB)) ? 1 : 0; // The open EB may have had everything trimmed
             if (peCount[i] > max) {
                 max = peCount[i];
             }
@@ -140,7 +300,17 @@ public:
             printf("ERROR: maxPEDiff mismatch %d - %d    %d != %d\n", max, min, max - min, maxPEDiff);
             ret = false;
         }
-        uint8_t val[eraseBlocks];
+        for (int g = 0; g * extentGroupLBAs < flashLBAs; g++) {
+            int n = 0;
+            for (int i = g * extentGroupLBAs; (i < (g + 1) * extentGroupLBAs) && (i < flashLBAs); i++) {
+                n += l2p_val(i) ? 1 : 0;
+            }
+            if (n != mappedCount[g]) {
+                printf("ERROR: mappedCount mismatch group %d %d != %d\n", g, n, mappedCount[g]);
+                ret = false;
+            }
+        }
+        uint8_t val[(eraseBlocks * lbasPerEB + 7) / 8];
         bzero(val, sizeof(val));
         for (int i = 0; i < flashLBAs; i++) {
             if (l2p_val(i)) {
@@ -150,11 +320,12 @@ public:
                     printf("ERROR: LBA %d points to metadata\n", i);
                     ret = false;
                 }
-                if (val[eb] & 1 << idx) {
+                int bit = eb * lbasPerEB + idx;
+                if (val[bit / 8] & 1 << (bit % 8)) {
                     printf("ERROR: LBA %d crosslinked in eb %d idx %d\n", i, eb, idx);
                     ret = false;
                 }
-                val[eb] |= 1 << idx;
+                val[bit / 8] |= 1 << (bit % 8);
             }
         }
         return ret;
@@ -162,11 +333,17 @@ public:
 
 
     bool start() {
+#if FTL_HISTOGRAMS
+        HistogramScope hs(this, FTLOpStart);
+#endif
+        drain();
+        openEB = -1;
+        openEBNextIndex = 0;
         _fi->deserialize();
         populateMetadataMap();
         if (loadHighestEpochMetadata()) {
-#if FTL_DEBUG
-            printf("restored metadata from flash\n");
+#if FTL_TRACE
+            trace(FTLTraceStart, 0, metadataEpoch);
 #endif
             metadataAge = 0;
             return true;
@@ -176,6 +353,9 @@ public:
     }
 
     bool persist() {
+#if FTL_HISTOGRAMS
+        HistogramScope hs(this, FTLOpPersist);
+#endif
         bool ret = doPersist();
         _fi->serialize();
         return ret;
@@ -188,74 +368,266 @@ public:
         return false;
     }
 
-    bool write(int lba, const uint8_t *data) {
-        if ((lba < 0) || (lba >= flashLBAs)) {
-            return false ;
+    // By default metadata is persisted every 256 writes/trims.  Without that the application decides when with
+    // persist() or persistIfDirty(), and anything after the last one is lost on power failure.
+    void setAutoPersist(bool enable) {
+        autoPersist = enable;
+    }
+
+    // Overlap flash erases and programs with FTL bookkeeping (and the caller's own work) using the FlashInterface
+    // asynchronous calls.  Up to `depth` operations may be in flight, each holding an LBA-sized copy of host data.
+    // 0 (the default) is completely synchronous.
+    void setPipelineDepth(int depth) {
+        drain();
+        delete[] pipelineBuff;
+        delete[] pipeline;
+        pipelineBuff = nullptr;
+        pipeline = nullptr;
+        pipelineDepth = depth;
+        if (depth) {
+            pipeline = new PipelineOp[depth];
+            pipelineBuff = new uint8_t[depth * lbaBytes];
+            for (int i = 0; i < depth; i++) {
+                pipeline[i].ftl = this;
+                pipeline[i].busy = false;
+                pipeline[i].buff = pipelineBuff + i * lbaBytes;
+            }
         }
-        if (openEB < 0) {
-            openEB = selectBestEB();
+    }
+
+    // Wait for any pipelined flash operations to complete
+    void drain() {
+        while (pipelinePending) {
+            _fi->poll();
         }
-#if FTL_DEBUG
-        printf("wrote %d to eb %d idx %d\n", lba, openEB, openEBNextIndex);
+    }
+
+    bool write(int lba, const uint8_t *data) {
+        return write(lba, data, 1);
+    }
+
+    // Writes `count` consecutive LBAs.  Each run that fits in the open EB is a single flash program, and the whole
+    // call only counts as one change towards the next automatic persist.
+    bool write(int lba, const uint8_t *data, int count) {
+#if FTL_HISTOGRAMS
+        HistogramScope hs(this, FTLOpWrite);
 #endif
-        if (!l2p_val(lba)) {
-            validLBAs++;
+        if ((lba < 0) || (count < 0) || (count > flashLBAs - lba)) {
+            return false ;
         }
-
-        _fi->program(openEB, openEBNextIndex * lbaBytes, data, lbaBytes);
-        int oldEB, oldIndex;
-        if (findLBA(lba, &oldEB, &oldIndex)) {
-            clearLBAValid(oldEB);
-            if (!getEBState(oldEB) && (oldEB != openEB)) {
-                emptyEBs++;
+        stats.hostWrites += count;
+        while (count) {
+            if (openEB < 0) {
+                openEB = selectBestEB();
             }
-        }
-        setLBAValid(openEB);
-        setLBA(lba, openEB, openEBNextIndex);
-        openEBNextIndex++;
-        if (openEBNextIndex >= ebBytes / lbaBytes) {
-            openEB = -1;
-            openEBNextIndex = 0;
+            int run = lbasPerEB - openEBNextIndex;
+            if (run > count) {
+                run = count;
+            }
+            flashProgram(openEB, openEBNextIndex * lbaBytes, data, run * lbaBytes);
+            // Only map the new copies once they're in flash
+            for (int i = 0; i < run; i++, lba++) {
+#if FTL_TRACE
+                trace(FTLTraceWrite, lba, openEB, openEBNextIndex);
+#endif
+                int oldEB, oldIndex;
+                if (findLBA(lba, &oldEB, &oldIndex)) {
+                    clearLBAValid(oldEB);
+                    if (!getEBState(oldEB) && (oldEB != openEB)) {
+                        emptyEBs++;
+                    }
+                } else {
+                    validLBAs++;
+                    mappedCount[lba / extentGroupLBAs]++;
+                }
+                setLBAValid(openEB);
+                setLBA(lba, openEB, openEBNextIndex);
+                openEBNextIndex++;
+            }
+            if (openEBNextIndex >= lbasPerEB) {
+                openEB = -1;
+                openEBNextIndex = 0;
+            }
+            data += run * lbaBytes;
+            count -= run;
         }
         ageMetadata();
         return true;
     }
 
     bool read(int lba, uint8_t *dest) {
-        if ((lba < 0) || (lba >= flashLBAs)) {
+        return read(lba, dest, 1);
+    }
+
+    // Reads `count` consecutive LBAs, with one flash read for each run which is also consecutive in flash
+    bool read(int lba, uint8_t *dest, int count) {
+#if FTL_HISTOGRAMS && !FTL_CONCURRENT_READS
+        HistogramScope hs(this, FTLOpRead);
+#endif
+        if ((lba < 0) || (count < 0) || (count > flashLBAs - lba)) {
             return false;
         }
-        int oldEB, oldIndex;
-        if (findLBA(lba, &oldEB, &oldIndex)) {
-            _fi->read(oldEB, oldIndex * lbaBytes, dest, lbaBytes);
-        } else {
-            bzero(dest, lbaBytes);
+#if FTL_CONCURRENT_READS
+        __atomic_fetch_add(&stats.hostReads, count, __ATOMIC_RELAXED);
+#else
+        stats.hostReads += count;
+#endif
+        while (count) {
+#if FTL_CONCURRENT_READS
+            // Seqlock: an old mapping still points at good data until that EB is erased, so that's all we need to catch
+            uint32_t seq = eraseSeq.load(std::memory_order_acquire);
+            if (seq & 1) {
+                continue; // Erase in progress
+            }
+#endif
+            int run = readRun(lba, dest, count);
+#if FTL_CONCURRENT_READS
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (eraseSeq.load(std::memory_order_relaxed) != seq) {
+                continue;
+            }
+#endif
+            lba += run;
+            dest += run * lbaBytes;
+            count -= run;
         }
         return true;
     }
 
     bool trim(int lba) {
-        if ((lba < 0) || (lba >= flashLBAs)) {
+        return trim(lba, 1);
+    }
+
+    // Trims [lba, lba + count), which then read back as zeros.  The whole range only counts as a single change
+    // towards the next automatic persist.
+    bool trim(int lba, int count) {
+#if FTL_HISTOGRAMS
+        HistogramScope hs(this, FTLOpTrim);
+#endif
+        if ((lba < 0) || (count < 0) || (count > flashLBAs - lba)) {
             return false;
         }
-        if (l2p_val(lba)) {
-#if FTL_DEBUG
-            printf("trim lba %d eb %d idx %d\n", lba, l2p_eb(lba), l2p_idx(lba));
-#endif
-            clearLBAValid(l2p_eb(lba));
-            validLBAs--;
-            if (!getEBState(l2p_eb(lba)) && (l2p_eb(lba) != openEB)) {
-                emptyEBs++;
-#if FTL_DEBUG
-                printf("freeing eb %d\n", l2p_eb(lba));
+        stats.hostTrims += count;
+        // Sequentially written data sits in runs in the same EB, so only update its state once per run
+        bool changed = false;
+        int runEB = -1;
+        int run = 0;
+        for (int i = lba; i < lba + count; i++) {
+            if (!l2p_val(i)) {
+                continue;
+            }
+#if FTL_TRACE
+            trace(FTLTraceTrim, i, l2p_eb(i), l2p_idx(i));
 #endif
+            if (l2p_eb(i) != runEB) {
+                releaseLBAs(runEB, run);
+                runEB = l2p_eb(i);
+                run = 0;
             }
-            l2p[lba] = 0; // invalid
+            run++;
+            validLBAs--;
+            mappedCount[i / extentGroupLBAs]--;
+            setL2P(i, 0); // invalid
+            changed = true;
+        }
+        releaseLBAs(runEB, run);
+        if (changed) {
             ageMetadata();
         }
         return true;
     }
 
+    // Returns how many LBAs starting at `lba` (up to `max`) are all mapped, or all unmapped and so read as zeros,
+    // and sets *mapped to which.  Groups which are entirely one or the other are skipped without touching the L2P.
+    int extent(int lba, int max, bool *mapped) {
+        if ((lba < 0) || (lba >= flashLBAs) || (max <= 0)) {
+            return 0;
+        }
+        if (max > flashLBAs - lba) {
+            max = flashLBAs - lba;
+        }
+        *mapped = l2p_val(lba);
+        int end = lba + max;
+        int i = lba;
+        while (i < end) {
+            if (!(i % extentGroupLBAs)) {
+                int g = i / extentGroupLBAs;
+                int groupLBAs = (flashLBAs - i < extentGroupLBAs) ? flashLBAs - i : extentGroupLBAs;
+                if (mappedCount[g] == (*mapped ? groupLBAs : 0)) {
+                    i += groupLBAs;
+                    continue;
+                }
+            }
+            if (l2p_val(i) != *mapped) {
+                break;
+            }
+            i++;
+        }
+        return ((i < end) ? i : end) - lba;
+    }
+
+    SPIFTLStats getStats() {
+        SPIFTLStats s = stats;
+        s.emptyEBs = emptyEBs;
+        s.validLBAs = validLBAs;
+        s.highestPECount = highestPECount;
+        s.peCountOffset = peCountOffset;
+        s.metadataAge = metadataAge;
+        s.gcStallAvgUS = stats.gcStalls ? gcStallTotalUS / stats.gcStalls : 0;
+        return s;
+    }
+
+#if FTL_HISTOGRAMS
+    const FTLHistogram *getHistogram(FTLOp op, int variant) {
+        return &histograms[op][variant];
+    }
+
+    void resetHistograms() {
+        bzero(histograms, sizeof(histograms));
+    }
+
+    void dumpHistograms() {
+        static const char *opName[FTLOps] = {"write", "read", "trim", "persist", "start"};
+        static const char *variantName[FTLVariants] = {"", "+gc", "+persist", "+gc+persist"};
+        for (int i = 0; i < FTLOps; i++) {
+            for (int j = 0; j < FTLVariants; j++) {
+                const FTLHistogram *h = &histograms[i][j];
+                if (h->count) {
+                    printf("%s%s: n=%u p50<%uus p99<%uus p999<%uus max=%uus\n", opName[i], variantName[j], h->count,
+                           h->percentileUS(50), h->percentileUS(99), h->percentileUS(99.9), h->maxUS);
+                }
+            }
+        }
+    }
+#endif
+
+#if FTL_TRACE
+    // Copy events newer than *cursor (0 to start), advancing it.  Returns the number copied.  If the caller falls
+    // more than FTL_TRACE_ENTRIES behind, the oldest are lost and *cursor skips ahead.
+    int readTrace(uint32_t *cursor, FTLTraceEntry *dest, int max) {
+        if (traceTotal - *cursor > FTL_TRACE_ENTRIES) {
+            *cursor = traceTotal - FTL_TRACE_ENTRIES;
+        }
+        int n = 0;
+        while ((n < max) && (*cursor != traceTotal)) {
+            dest[n++] = traceRing[(*cursor)++ & (FTL_TRACE_ENTRIES - 1)];
+        }
+        return n;
+    }
+
+    // Send the header and entire ring, oldest first, through `out` (i.e. fwrite to a file or Serial.write)
+    void dumpTrace(void (*out)(const void *data, int len, void *arg), void *arg) {
+        uint32_t cursor = 0;
+        FTLTraceHeader h = {{'F', 'T', 'L', 'T', 'R', 'C', '0', '1'}, sizeof(FTLTraceEntry), 0, traceTotal};
+        h.count = traceTotal < FTL_TRACE_ENTRIES ? traceTotal : FTL_TRACE_ENTRIES;
+        out(&h, sizeof(h), arg);
+        FTLTraceEntry e;
+        while (readTrace(&cursor, &e, 1)) {
+            out(&e, sizeof(e), arg);
+        }
+    }
+#endif
+
     void dump() {
 #if FTL_DEBUG
         printf("Erase Blocks (maxpe=%d, peCountOffset=%d, emptyEBs=%d, validLBAs=%d)\n", highestPECount, peCountOffset, emptyEBs, validLBAs);
@@ -270,8 +642,8 @@ public:
 #endif
     }
 
-    const int ebBytes = 4096;
-    const int lbaBytes = 512;
+    const int ebBytes;
+    const int lbaBytes;
     const int maxPEDiff = 64;
 
 private:
@@ -283,7 +655,11 @@ private:
     int metaEBs;
     int flashLBAs;
     int flashWriteBufferSize;
+    int lbasPerEB;
+    int l2pIdxBits;
+    int l2pEBBits;
 
+    // Only compared against the on-flash copy, so truncation of large values (i.e. 64KB EBs) is harmless
     typedef struct {
         uint16_t ebBytes;
         uint16_t lbaBytes;
@@ -293,8 +669,11 @@ private:
     } FTLInfo;
 
     uint8_t *peCount; // We'll just track up to 250, and when we hit 251 we will subtract maxPEDiff from them all
-    // ebState: 0 = free, 1...8 = # of LBAs valid, 9..0xe = undefined, 0xf = meta
-    const unsigned int ebMeta = 0x0f;
+    // ebState: 0 = free, 1...lbasPerEB = # of LBAs valid, ebMeta = meta, others undefined
+    // Packed as nibbles (ebMeta = 0xf) when lbasPerEB < 15, otherwise 1 byte per EB (ebMeta = 0xff)
+    bool wideEBState;
+    unsigned int ebMeta;
+    int ebStateBytes;
     uint8_t *ebState;
     int16_t *metaEBList;
 
@@ -303,22 +682,108 @@ private:
     int emptyEBs;
     int validLBAs;
     uint8_t metadataAge;
+    bool autoPersist = true;
 
     // L2P format.  Can't use bitfields since GCC will make every element 32-bits
+    // The EB/idx split depends on the geometry, 4KB EB/512b LBA is:
     //typedef struct {
-    //    unsigned eb  : 12;
-    //    unsigned idx : 3;
+    //    unsigned eb  : 12; // l2pEBBits
+    //    unsigned idx : 3;  // l2pIdxBits
     //    unsigned val : 1;
     //} L2P;
     typedef uint16_t L2P;
     L2P *l2p;
 
+    // Mapped LBAs in each group of extentGroupLBAs, so extent() can skip over runs quickly
+    static const int extentGroupLBAs = 64;
+    uint8_t *mappedCount;
+
     int openEB = -1; // EB currently being written.  < 0 == none open
     int openEBNextIndex = 0; // Which LBA w/in that EBA should be written next
+    int gcEB = 0; // The current EB to GC, we'll start at the last eb checked and loop around
+    uint16_t *gcMoved; // LBAs copied by collectValidLBAs() waiting to be remapped
+#if FTL_CONCURRENT_READS
+    std::atomic<uint32_t> eraseSeq{0}; // Bumped before and after every erase, see read()
+#endif
+
+    // Cumulative counters for getStats(), bumped inline so they cost next to nothing
+    SPIFTLStats stats = {};
+    uint64_t gcStallTotalUS = 0;
+
+#if FTL_HISTOGRAMS
+    // ---- LATENCY HISTOGRAMS
+
+    // Only the outermost public call is timed, i.e. a persist() inside write() marks the write as +persist
+    FTLHistogram histograms[FTLOps][FTLVariants] = {};
+    int histogramDepth = 0;
+    int histogramVariant = 0;
+
+    class HistogramScope {
+    public:
+        HistogramScope(SPIFTL *ftl, FTLOp op) : _ftl(ftl), _op(op) {
+            if (!_ftl->histogramDepth++) {
+                _ftl->histogramVariant = 0;
+                _start = FTL_MICROS();
+            }
+        }
+        ~HistogramScope() {
+            if (!--_ftl->histogramDepth) {
+                uint32_t us = FTL_MICROS() - _start;
+                int b = 0;
+                while ((b < 23) && (us >> b)) {
+                    b++;
+                }
+                int variant = _ftl->histogramVariant & ~(_op == FTLOpPersist ? FTLVariantPersist : 0);
+                FTLHistogram *h = &_ftl->histograms[_op][variant];
+                h->bucket[b]++;
+                h->count++;
+                if (us > h->maxUS) {
+                    h->maxUS = us;
+                }
+            }
+        }
+    private:
+        SPIFTL *_ftl;
+        FTLOp _op;
+        uint32_t _start = 0;
+    };
+#endif
+
+#if FTL_TRACE
+    // ---- TRACE RING BUFFER
+
+    static_assert(!(FTL_TRACE_ENTRIES & (FTL_TRACE_ENTRIES - 1)), "FTL_TRACE_ENTRIES must be a power of 2");
+    FTLTraceEntry traceRing[FTL_TRACE_ENTRIES];
+    uint32_t traceTotal = 0;
+
+    void trace(FTLTraceEvent event, int a = 0, uint32_t b = 0, uint32_t c = 0) {
+        FTLTraceEntry *e = &traceRing[traceTotal++ & (FTL_TRACE_ENTRIES - 1)];
+        e->us = FTL_MICROS();
+        e->event = event;
+        e->a = a;
+        e->b = b;
+        e->c = c;
+    }
+#endif
+
+    // Tag following flash operations for accounting, returning the old tag so callers can restore it
+    FlashCategory flashCategory = FlashCategoryHost;
+    FlashCategory setFlashCategory(FlashCategory c) {
+        FlashCategory old = flashCategory;
+        if (c != old) {
+            flashCategory = c;
+            _fi->setCategory(c);
+        }
+        return old;
+    }
 
     // ---- L2P AND ERASE BLOCK MANAGEMENT
 
     inline void setEBState(int eb, unsigned int state) {
+        if (wideEBState) {
+            ebState[eb] = state;
+            return;
+        }
         int idx = eb / 2;
         if (eb & 1) {
             ebState[idx] = (ebState[idx] & 0x0f) | (state << 4);
@@ -328,6 +793,9 @@ private:
     }
 
     inline unsigned int getEBState(int eb) {
+        if (wideEBState) {
+            return ebState[eb];
+        }
         return 0x0f & (ebState[eb / 2] >> ((eb & 1) ? 4 : 0));
     }
 
@@ -340,11 +808,11 @@ private:
     }
 
     inline uint16_t l2p_eb(int lba) {
-        return l2p[lba] & ((1 << 12) - 1);
+        return l2p[lba] & ((1 << l2pEBBits) - 1);
     }
 
     inline uint8_t l2p_idx(int lba) {
-        return (l2p[lba] >> 12) & ((1 << 3) - 1);
+        return (l2p[lba] >> l2pEBBits) & ((1 << l2pIdxBits) - 1);
     }
 
     inline bool l2p_val(int lba) {
@@ -353,7 +821,7 @@ private:
 
     inline L2P make_l2p(int idx, int eb) {
         L2P t = 1 << 15;
-        t |= idx << 12;
+        t |= idx << l2pEBBits;
         t |= eb;
         return t;
     }
@@ -376,8 +844,151 @@ private:
         }
     }
 
+    inline L2P getL2P(int lba) {
+#if FTL_CONCURRENT_READS
+        return __atomic_load_n(&l2p[lba], __ATOMIC_ACQUIRE);
+#else
+        return l2p[lba];
+#endif
+    }
+
+    // Reads LBAs from `lba` (up to `max`) which are either unmapped or sit one after another in the same EB, returning
+    // how many that was
+    int readRun(int lba, uint8_t *dest, int max) {
+        L2P e = getL2P(lba);
+        int n = 1;
+        if (!(e & 1 << 15)) {
+            while ((n < max) && !(getL2P(lba + n) & 1 << 15)) {
+                n++;
+            }
+            bzero(dest, n * lbaBytes);
+            return n;
+        }
+        int eb = e & ((1 << l2pEBBits) - 1);
+        int idx = (e >> l2pEBBits) & ((1 << l2pIdxBits) - 1);
+        while ((n < max) && (idx + n < lbasPerEB) && (getL2P(lba + n) == make_l2p(idx + n, eb))) {
+            n++;
+        }
+        _fi->read(eb, idx * lbaBytes, dest, n * lbaBytes);
+        return n;
+    }
+
+    inline void setL2P(int lba, L2P val) {
+#if FTL_CONCURRENT_READS
+        __atomic_store_n(&l2p[lba], val, __ATOMIC_RELEASE); // Readers must see the flash data before the mapping
+#else
+        l2p[lba] = val;
+#endif
+    }
+
+    // Drops `count` trimmed LBAs from an EB's valid count.  An open EB left with nothing valid is closed and freed
+    // right away instead of finishing it off with new writes and then GCing it.
+    void releaseLBAs(int eb, int count) {
+        if (!count) {
+            return;
+        }
+        setEBState(eb, getEBState(eb) - count);
+        if (!getEBState(eb)) {
+            if (eb == openEB) {
+                openEB = -1;
+                openEBNextIndex = 0;
+            }
+            emptyEBs++;
+#if FTL_TRACE
+            trace(FTLTraceFreeEB, 0, eb);
+#endif
+        }
+    }
+
     inline void setLBA(int lba, int eb, int idx) {
-        l2p[lba] = make_l2p(idx, eb);
+        setL2P(lba, make_l2p(idx, eb));
+    }
+
+
+    // ---- PIPELINED FLASH OPERATIONS
+
+    // Flash completes operations in order, so an erase started after a GC copy out of the same EB is safe.  Only CPU
+    // accesses to readEB() memory (metadata) need an explicit drain(), since FlashInterface::read() waits on its own.
+    typedef struct {
+        SPIFTL *ftl;
+        bool busy;
+        uint8_t *buff;
+    } PipelineOp;
+    PipelineOp *pipeline = nullptr;
+    uint8_t *pipelineBuff = nullptr;
+    int pipelineDepth = 0;
+    int pipelinePending = 0;
+
+    static void pipelineDone(void *arg, bool ok) {
+        (void) ok;
+        PipelineOp *op = (PipelineOp *)arg;
+        op->busy = false;
+        op->ftl->pipelinePending--;
+    }
+
+    PipelineOp *pipelineSlot() {
+        while (true) {
+            for (int i = 0; i < pipelineDepth; i++) {
+                if (!pipeline[i].busy) {
+                    pipeline[i].busy = true;
+                    pipelinePending++;
+                    return &pipeline[i];
+                }
+            }
+            _fi->poll();
+        }
+    }
+
+    void flashErase(int eb) {
+        stats.erases[flashCategory]++;
+#if FTL_CONCURRENT_READS
+        assert(!pipelineDepth);
+        eraseSeq.fetch_add(1, std::memory_order_acq_rel); // Odd while erasing
+        _fi->eraseBlock(eb);
+        eraseSeq.fetch_add(1, std::memory_order_release);
+        return;
+#endif
+        if (pipelineDepth) {
+            _fi->startErase(eb, pipelineDone, pipelineSlot());
+        } else {
+            _fi->eraseBlock(eb);
+        }
+    }
+
+    // Host data is copied since the caller's buffer is only valid until we return, an LBA per pipeline slot.
+    // Otherwise a run can be a whole EB, so it goes out as writeBufferSize() pieces which the FlashInterface can
+    // program one at a time instead of blocking (with IRQs off on the RP2040) for the entire run.
+    void flashProgram(int eb, int offset, const void *data, int size) {
+        const uint8_t *src = (const uint8_t *)data;
+        if (pipelineDepth) {
+            for (int done = 0; done < size; done += lbaBytes) {
+                PipelineOp *op = pipelineSlot();
+                memcpy(op->buff, src + done, lbaBytes);
+                _fi->startProgram(eb, offset + done, op->buff, lbaBytes, pipelineDone, op);
+            }
+        } else {
+            FlashProgramVec vec[8];
+            for (int done = 0; done < size;) {
+                int vecs = 0;
+                for (; (vecs < (int)(sizeof(vec) / sizeof(vec[0]))) && (done < size); vecs++, done += flashWriteBufferSize) {
+                    vec[vecs].offset = offset + done;
+                    vec[vecs].data = src + done;
+                    vec[vecs].size = flashWriteBufferSize;
+                }
+                _fi->programv(eb, vec, vecs);
+            }
+        }
+    }
+
+    // GC copies come straight from flash, which stays put until a later erase
+    void flashProgramv(int eb, const FlashProgramVec *vec, int count) {
+        if (pipelineDepth) {
+            for (int i = 0; i < count; i++) {
+                _fi->startProgram(eb, vec[i].offset, vec[i].data, vec[i].size, pipelineDone, pipelineSlot());
+            }
+        } else {
+            _fi->programv(eb, vec, count);
+        }
     }
 
 
@@ -387,12 +998,14 @@ private:
     // 8 byte header:   <signature0..7>
     // 3 byte epoch:    <e><e><e> = 2^23 cycles, way beyond flash lifetime
     // 1 byte index:    <i> = Block within this metadata serialization, since more than one EB needed
-    // 4080 byte:       <d>...<d> = packed metadata
-    // 4 byte checksum: <c><c><c><c> = CRC32 over bytes 0...4091
+    // ebBytes-16 byte: <d>...<d> = packed metadata
+    // 4 byte checksum: <c><c><c><c> = CRC32 over bytes 0...ebBytes-5
 
     // Metadata packed format
     // ftlInfo:peCountArray:l2pArray:peCountOffset:highestPECount:emptyEBs:validLBAs
 
+public:
+    // Exposed so benchmarks can measure it directly
     class MetadataCRC32 {
     public:
         MetadataCRC32() {
@@ -432,6 +1045,8 @@ private:
         uint32_t crc;
     };
 
+private:
+
     const char metadataSig[8] = {'S', 'P', 'I', 'F', 'T', 'L', '0', '1'};
     std::vector<uint16_t> metadataEBList;
     int metadataEBoffset;
@@ -440,9 +1055,10 @@ private:
     uint32_t metadataEpoch = 2; // epoch 0 and 1 are part of formatting on flash, all empty
 
     void openMetadataStreamForWrite() {
-#if FTL_DEBUG
-        printf("Serializing metadata epoch %d\n", (int)metadataEpoch + 1);
+#if FTL_TRACE
+        trace(FTLTracePersist, 0, metadataEpoch + 1);
 #endif
+        drain(); // We're going to CRC the existing MD straight from flash
         metadataEBList.clear();
         for (int j = 0; j < metaEBs; j++) {
             int i = metaEBList[j];
@@ -451,9 +1067,9 @@ private:
             }
             const uint8_t *eb = _fi->readEB(i);
             metadataCRC.reset();
-            metadataCRC.add(eb, 4096 - 4);
+            metadataCRC.add(eb, ebBytes - 4);
             uint32_t crc = metadataCRC.get();
-            bool err = memcmp(&crc, eb + 4096 - 4, 4);
+            bool err = memcmp(&crc, eb + ebBytes - 4, 4);
             uint32_t mde = *(uint32_t*)(_fi->readEB(i) + 8) >> 8;
 #if FTL_DEBUG
             printf("metaEBList[%d] = %d, epoch %d, err %d\n", j, i, (int)mde, err);
@@ -461,13 +1077,16 @@ private:
             if (err || (mde < metadataEpoch)) {
                 if (!err) {
                     // Need to erase the MD in this block or we can end up with a large number of old MD blocks, wasting time and memory during FTL bringup
+                    FlashCategory cat = setFlashCategory(FlashCategoryMetaPersist);
+                    stats.erases[flashCategory]++;
                     _fi->eraseBlock(i);
+                    setFlashCategory(cat);
                 }
                 setEBState(i, 0);
                 metaEBList[j] = -1;
                 emptyEBs++;
-#if FTL_DEBUG
-                printf("Free %d\n", i);
+#if FTL_TRACE
+                trace(FTLTraceMetaFree, 0, i);
 #endif
             }
         }
@@ -478,8 +1097,8 @@ private:
             }
             int eb = lowestEmptyEB();
             metadataEBList.push_back(eb);
-#if FTL_DEBUG
-            printf("Allocating %d\n ", eb);
+#if FTL_TRACE
+            trace(FTLTraceMetaAlloc, 0, eb);
 #endif
             setEBMeta(eb);
             metaEBList[i] = eb;
@@ -493,10 +1112,10 @@ private:
     }
 
     inline void writeMetadata8b(uint8_t b, char *wb) {
-        if (metadataEBoffset == 4096 - 4) {
+        if (metadataEBoffset == ebBytes - 4) {
             uint32_t crc = metadataCRC.get();
             memcpy(&wb[flashWriteBufferSize - 4], &crc, 4);
-            _fi->program(metadataEBList.front(), 4096 - flashWriteBufferSize, wb, flashWriteBufferSize);
+            _fi->program(metadataEBList.front(), ebBytes - flashWriteBufferSize, wb, flashWriteBufferSize);
             metadataEBList.erase(metadataEBList.begin());
             metadataCRC.reset();
             metadataEBoffset = 0;
@@ -545,6 +1164,7 @@ private:
 
     bool doPersist() {
         char wb[flashWriteBufferSize]; // Keep on stack to avoid needing to malloc() from inside persist
+        FlashCategory cat = setFlashCategory(FlashCategoryMetaPersist);
 
         openMetadataStreamForWrite(); // Will increment epoch, choose oldest MD copy to overwrite
 
@@ -561,7 +1181,7 @@ private:
         }
 
         // Dump ebState
-        for (int i = 0; i < (eraseBlocks + 1) / 2; i++) {
+        for (int i = 0; i < ebStateBytes; i++) {
             writeMetadata8b(ebState[i], wb);
         }
 
@@ -577,6 +1197,11 @@ private:
         closeMetadataStream(wb); // Will 0-fill and add checksum at end
 
         metadataAge = 0;
+        stats.persists++;
+#if FTL_HISTOGRAMS
+        histogramVariant |= FTLVariantPersist;
+#endif
+        setFlashCategory(cat);
 
         return true;
     }
@@ -594,9 +1219,9 @@ private:
             const uint8_t *eb = _fi->readEB(i);
             if (!memcmp(eb, metadataSig, 8)) {
                 metadataCRC.reset();
-                metadataCRC.add(eb, 4096 - 4);
+                metadataCRC.add(eb, ebBytes - 4);
                 uint32_t crc = metadataCRC.get();
-                if (!memcmp(&crc, eb + 4096 - 4, 4)) {
+                if (!memcmp(&crc, eb + ebBytes - 4, 4)) {
                     uint32_t epoch = *(const uint32_t *)&eb[8];
 #if FTL_DEBUG
                     printf("Found MD epoch %d, idx %d at eb %d\n", (int)(epoch >> 8), (int)(epoch & 0xff), i);
@@ -634,7 +1259,7 @@ private:
     }
 
     inline uint8_t readMetadata8b() {
-        if (metadataEBoffset >= 4096 - 4) {
+        if (metadataEBoffset >= ebBytes - 4) {
             metadataEBoffset = 0;
             metadataEBList.erase(metadataEBList.begin());
             mdOpenEB = _fi->readEB(metadataEBList.front());
@@ -716,29 +1341,27 @@ private:
             metaEBList[i] = -1;
         }
         emptyEBs = 0;
-        for (int i = 0, j = 0; i < (eraseBlocks + 1) / 2; i++) {
+        for (int i = 0; i < ebStateBytes; i++) {
             ebState[i] = readMetadata8b();
-            // Restore metaEBList as we read in
-            if (ebIsMeta(i * 2)) {
-                metaEBList[j++] = i * 2;
-            }
-            if (ebIsMeta(i * 2 + 1)) {
-                metaEBList[j++] = i * 2 + 1;
-            }
-            if (getEBState(i * 2) == 0) {
-                emptyEBs++;
+        }
+        // Restore metaEBList and empty count from the states
+        for (int i = 0, j = 0; i < eraseBlocks; i++) {
+            if (ebIsMeta(i)) {
+                metaEBList[j++] = i;
             }
-            if (getEBState(i * 2 + 1) == 0) {
+            if (getEBState(i) == 0) {
                 emptyEBs++;
             }
         }
 
         validLBAs = 0;
+        bzero(mappedCount, (flashLBAs + extentGroupLBAs - 1) / extentGroupLBAs);
         uint16_t *q = (uint16_t*)(l2p);
         for (int i = 0; i < flashLBAs; i++) {
             q[i] = readMetadata16b();
             if (l2p_val(i)) {
                 validLBAs++;
+                mappedCount[i / extentGroupLBAs]++;
             }
         }
 
@@ -802,7 +1425,7 @@ private:
 #endif
             pass = false;
         }
-        uint8_t val[eraseBlocks];
+        uint8_t val[(eraseBlocks * lbasPerEB + 7) / 8];
         bzero(val, sizeof(val));
         for (int i = 0; i < flashLBAs; i++) {
             if (l2p_val(i)) {
@@ -814,23 +1437,24 @@ private:
 #endif
                     pass = false;
                 }
-                if (val[eb] & 1 << idx) {
+                int bit = eb * lbasPerEB + idx;
+                if (val[bit / 8] & 1 << (bit % 8)) {
 #if FTL_DEBUG
                     printf("ERROR: LBA %d crosslinked in eb %d idx %d\n", i, eb, idx);
 #endif
                     pass = false;
                 }
-                val[eb] |= 1 << idx;
+                val[bit / 8] |= 1 << (bit % 8);
             }
         }
         return pass;
     }
 
     void eraseEB(int eb) {
-#if FTL_DEBUG
-        printf("EraseEB(%d)\n", eb);
+#if FTL_TRACE
+        trace(FTLTraceErase, 0, eb, peCount[eb]);
 #endif
-        _fi->eraseBlock(eb);
+        flashErase(eb);
         if (peCount[eb] > 250) {
             for (int i = 0; i < eraseBlocks; i++) {
                 if (peCount[i] > maxPEDiff) {
@@ -871,7 +1495,8 @@ private:
         int lowestEmptyPE = 1 << 16; // 1 more than highest possible PECOUNT
         int lowestEmptyIdx = -1;
         for (int i = 0; i < eraseBlocks; i++) {
-            if ((peCount[i] <= lowestEmptyPE) && (getEBState(i) == 0)) {
+            // The open EB can have no valid LBAs after trims but is still in use
+            if ((peCount[i] <= lowestEmptyPE) && (getEBState(i) == 0) && (i != openEB)) {
                 lowestEmptyPE = peCount[i];
                 lowestEmptyIdx = i;
             }
@@ -895,6 +1520,13 @@ private:
     }
 
     void ageMetadata() {
+        if (!autoPersist) {
+            // Saturate so persistIfDirty() still knows there's something to save
+            if (metadataAge < 255) {
+                metadataAge++;
+            }
+            return;
+        }
         if (++metadataAge == 0) {
             // Every 256 writes we
             persist();
@@ -907,28 +1539,50 @@ private:
     int collectValidLBAs(int srcEB, int destEB, int destIdx) {
         int curIdx = destIdx;
         const uint8_t *readAddr = _fi->readEB(srcEB);
-        for (int i = 0; (i < flashLBAs) && (curIdx < 8); i++) {
+        // Batch the copies into as few programv() calls as possible.  Destination is always sequential,
+        // so LBAs which were also sequential in the source merge into a single segment
+        FlashProgramVec vec[8];
+        int vecs = 0;
+        for (int i = 0; (i < flashLBAs) && (curIdx < lbasPerEB); i++) {
             if ((l2p_eb(i) == srcEB) && l2p_val(i)) {
-#if FTL_DEBUG
-                printf("moving lba%02d to eb%d idx%d\n", i, destEB, curIdx);
+#if FTL_TRACE
+                trace(FTLTraceGCMove, i, destEB, curIdx);
 #endif
-                uint8_t buff[flashWriteBufferSize];
-                for (int j = 0; j < lbaBytes; j += sizeof(buff)) {
-                    memcpy(buff, readAddr + 512 * l2p_idx(i) + j, sizeof(buff));
-                    _fi->program(destEB, 512 * curIdx + j, buff, sizeof(buff));
-                }
-                clearLBAValid(srcEB);
-                if (getEBState(srcEB) == 0) {
-                    emptyEBs++;
+                const uint8_t *src = readAddr + lbaBytes * l2p_idx(i);
+                if (vecs && ((const uint8_t *)vec[vecs - 1].data + vec[vecs - 1].size == src)) {
+                    vec[vecs - 1].size += lbaBytes;
+                } else {
+                    if (vecs == (int)(sizeof(vec) / sizeof(vec[0]))) {
+                        flashProgramv(destEB, vec, vecs);
+                        vecs = 0;
+                    }
+                    vec[vecs].offset = lbaBytes * curIdx;
+                    vec[vecs].data = src;
+                    vec[vecs].size = lbaBytes;
+                    vecs++;
                 }
-                l2p[i] = make_l2p(curIdx, destEB);
-                setEBState(destEB, getEBState(destEB) + 1);
+                gcMoved[curIdx - destIdx] = i;
                 curIdx++;
             }
         }
+        if (vecs) {
+            flashProgramv(destEB, vec, vecs);
+        }
+        // Only remap once the copies are in flash.  The originals stay good until srcEB is erased, so concurrent
+        // readers never see a half-written LBA.
+        for (int i = destIdx; i < curIdx; i++) {
+            clearLBAValid(srcEB);
+            if (getEBState(srcEB) == 0) {
+                emptyEBs++;
+            }
+            setL2P(gcMoved[i - destIdx], make_l2p(i, destEB));
+            setEBState(destEB, getEBState(destEB) + 1);
+        }
+        stats.gcRelocated += curIdx - destIdx;
         return curIdx;
     }
 
+    // 0 = nothing to gain, 1..lbasPerEB-1 = reclaimable LBAs, lbasPerEB+1 = getting old, lbasPerEB+2+ = aged out
     inline int gcScore(int eb) {
         unsigned int state = getEBState(eb);
         if ((state == ebMeta) || !state) {
@@ -936,38 +1590,51 @@ private:
         }
         int delta = highestPECount - peCount[eb];
         if (delta >= maxPEDiff) {
-            return 10 + delta - maxPEDiff; // Aged out, choose oldest
+            return lbasPerEB + 2 + delta - maxPEDiff; // Aged out, choose oldest
         }
         if (delta > ((maxPEDiff * 7) / 8)) {
-            return 9; // Getting old, try to move before timeout
+            return lbasPerEB + 1; // Getting old, try to move before timeout
         }
-        return 8 - state;
+        return lbasPerEB - state;
     }
 
     int garbageCollect() {
         int ebScore = 0;
         int destEB = lowestEmptyEB(); // We'll write data into the youngest flash
         assert(destEB >= 0);
+        FlashCategory cat = setFlashCategory(FlashCategoryGC);
+        stats.gcRuns++;
+#if FTL_HISTOGRAMS
+        histogramVariant |= FTLVariantGC;
+#endif
         eraseEB(destEB);
         emptyEBs--;
-        for (int cnt = 0; (getEBState(destEB) < 8) && (cnt < 8); cnt++) {   // Loop until full or at most 8 times since we should have at least 1 move per cycle
-            static int eb = 0; // The current EB to GC, we'll start at the last eb checked and loop around
+        for (int cnt = 0; ((int)getEBState(destEB) < lbasPerEB) && (cnt < lbasPerEB); cnt++) {   // Loop until full or at most lbasPerEB times since we should have at least 1 move per cycle
+            int &eb = gcEB;
             // Find first non-meta EB
             while (ebIsMeta(eb) || (eb == destEB)) {
                 eb = (eb + 1) % eraseBlocks;
             }
             ebScore = gcScore(eb);
-            for (int i = 1; (i < eraseBlocks) && (ebScore < 8); i++) {
+            for (int i = 1; (i < eraseBlocks) && (ebScore < lbasPerEB); i++) {
                 int ebMod = (eb + i) % eraseBlocks;
                 if ((ebScore < gcScore(ebMod)) && (ebMod != destEB)) {
                     eb = ebMod;
                     ebScore = gcScore(eb);
                 }
             }
-            assert(ebScore > 0); // ERROR, couldn't find anything...we're toast
+            if (!ebScore) {
+                // Everything left is fully valid, so leave destEB partially filled
+                assert(getEBState(destEB) > 0); // ERROR, couldn't find anything...we're toast
+                break;
+            }
             assert(eb != destEB);
+#if FTL_TRACE
+            trace(FTLTraceGC, ebScore, eb, destEB);
+#endif
             setEBState(destEB, collectValidLBAs(eb, destEB, getEBState(destEB)));
         }
+        setFlashCategory(cat);
         return ebScore;
     }
 
@@ -980,36 +1647,45 @@ private:
             }
             if (highestPECount - peCount[eb] >= maxPEDiff) {
                 int destEB = lowestEmptyEB(); // We'll write data into the youngest flash
-#if FTL_DEBUG
-                printf("Aged-out metadata %d to %d\n", eb, destEB);
+#if FTL_TRACE
+                trace(FTLTraceMetaAge, 0, eb, destEB);
 #endif
                 assert(destEB >= 0);
                 assert(destEB != eb);
+                FlashCategory cat = setFlashCategory(FlashCategoryMetaAge);
                 eraseEB(destEB);
-                const uint8_t *readAddr = _fi->readEB(eb);
-                uint8_t buff[flashWriteBufferSize];
-                for (int i = 0; i < ebBytes; i += sizeof(buff)) {
-                    memcpy(buff, readAddr + i, sizeof(buff));
-                    _fi->program(destEB, i, buff, sizeof(buff));
-                }
+                FlashProgramVec vec = {0, _fi->readEB(eb), ebBytes};
+                _fi->programv(destEB, &vec, 1);
+                setFlashCategory(cat);
                 setEBState(eb, 0);
                 setEBMeta(destEB);
                 metaEBList[i] = destEB;
+                stats.metaAgeMoves++;
             }
         }
     }
 
     int selectBestEB() {
         int ebScore = 0;
-        // We need 3 EBs minimum to be free, and any score > 10 means we need to move for PE count wear leveling
-        while ((emptyEBs < 3) || (ebScore > 10)) {
+        bool stall = emptyEBs < 3;
+        uint32_t start = stall ? FTL_MICROS() : 0;
+        // We need 3 EBs minimum to be free, and any score > lbasPerEB + 2 means we need to move for PE count wear leveling
+        while ((emptyEBs < 3) || (ebScore > lbasPerEB + 2)) {
             ebScore = garbageCollect();
             metaAgeRewrite();
         }
+        if (stall) {
+            uint32_t us = FTL_MICROS() - start;
+            stats.gcStalls++;
+            gcStallTotalUS += us;
+            if (us > stats.gcStallMaxUS) {
+                stats.gcStallMaxUS = us;
+            }
+        }
         emptyEBs--;
         int eb = lowestEmptyEB();
-#if FTL_DEBUG
-        printf("selectBestEB() = %d\n", eb);
+#if FTL_TRACE
+        trace(FTLTraceSelectEB, 0, eb);
 #endif
         eraseEB(eb);
         return eb;
@@ -0,0 +1,121 @@
+/*
+    WorkloadGenerator.h - Synthetic FAT-like block workloads for benchmarking SPIFTL
+
+    Copyright (c) 2024 Earle F. Philhower, III <earlephilhower@yahoo.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program. If not, see https://www.gnu.org/licenses/
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+
+typedef struct {
+    double zipf;            // Hotness skew of run starts, 0 = uniform, ~1 = a few sectors (FAT, directories) take most writes
+    int seqRun;             // Mean sequential run length in LBAs (file data), 1 = purely random
+    double trimRatio;       // Fraction of runs which are trims (file deletes) instead of writes
+    double staticFraction;  // Fraction of the device written once up front and never again (OS image, media)
+    uint32_t seed;
+} WorkloadParams;
+
+typedef struct {
+    bool trim;
+    int lba;
+} WorkloadOp;
+
+// Runs start at a Zipf-distributed rank, with the hottest ranks at the lowest LBAs like a FAT table, and continue
+// sequentially for a geometrically distributed length.  The static region sits at the top of the device.
+class WorkloadGenerator {
+public:
+    WorkloadGenerator(int lbas, const WorkloadParams &params) : _p(params) {
+        _staticLBAs = (int)(lbas * _p.staticFraction);
+        _dynamicLBAs = lbas - _staticLBAs;
+        if (_dynamicLBAs < 1) {
+            _dynamicLBAs = 1;
+            _staticLBAs = lbas - 1;
+        }
+        _state = _p.seed ? _p.seed : 1;
+        if (_p.zipf > 0) {
+            _cdf.resize(_dynamicLBAs);
+            double sum = 0;
+            for (int i = 0; i < _dynamicLBAs; i++) {
+                sum += 1.0 / pow(i + 1, _p.zipf);
+                _cdf[i] = sum;
+            }
+            for (auto &c : _cdf) {
+                c /= sum;
+            }
+        }
+    }
+
+    // LBAs [dynamicLBAs(), lbas) are the static region
+    int dynamicLBAs() {
+        return _dynamicLBAs;
+    }
+
+    WorkloadOp next() {
+        if (!_runLeft) {
+            _runLBA = start();
+            _runTrim = uniform() < _p.trimRatio;
+            // Geometric with mean seqRun
+            _runLeft = 1;
+            double cont = _p.seqRun > 1 ? 1.0 - 1.0 / _p.seqRun : 0;
+            while ((uniform() < cont) && (_runLeft < _dynamicLBAs)) {
+                _runLeft++;
+            }
+        }
+        WorkloadOp op = {_runTrim, _runLBA};
+        _runLBA = (_runLBA + 1) % _dynamicLBAs;
+        _runLeft--;
+        return op;
+    }
+
+private:
+    // xorshift32, so runs are repeatable everywhere regardless of the C library's rand()
+    double uniform() {
+        _state ^= _state << 13;
+        _state ^= _state >> 17;
+        _state ^= _state << 5;
+        return _state / 4294967296.0;
+    }
+
+    int start() {
+        double u = uniform();
+        if (_cdf.empty()) {
+            return (int)(u * _dynamicLBAs);
+        }
+        int lo = 0;
+        int hi = _dynamicLBAs - 1;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (_cdf[mid] < u) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    WorkloadParams _p;
+    int _staticLBAs;
+    int _dynamicLBAs;
+    uint32_t _state;
+    std::vector<double> _cdf;
+    int _runLBA = 0;
+    int _runLeft = 0;
+    bool _runTrim = false;
+};
@@ -0,0 +1,104 @@
+/*
+    AsyncBench.cpp - Measure overlap of flash operations with host work using the pipelined FTL
+
+    Copyright (c) 2024 Earle F. Philhower, III <earlephilhower@yahoo.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program. If not, see https://www.gnu.org/licenses/
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <cassert>
+#include <chrono>
+#include <list>
+#include <map>
+
+#include "SPIFTL.h"
+#include "FlashInterfaceRAMAsync.h"
+
+// Keep host file I/O out of the measurement
+class FlashInterfaceRAMAsyncNoSave : public FlashInterfaceRAMAsync {
+public:
+    FlashInterfaceRAMAsyncNoSave(int size, int eraseUS, int programUSPerPage) : FlashInterfaceRAMAsync(size, eraseUS, programUSPerPage) {
+    }
+
+    virtual void serialize() override {
+    }
+
+    virtual void deserialize() override {
+    }
+};
+
+static double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Stand-in for the application preparing the next sector
+static void hostWork(int us) {
+    double end = now() + us / 1000000.0;
+    while (now() < end) {
+        /* spin */
+    }
+}
+
+static void run(int depth, int writes, int eraseUS, int programUS, int workUS) {
+    FlashInterfaceRAMAsyncNoSave fi(256 * 1024, eraseUS, programUS);
+    SPIFTL ftl(&fi);
+    ftl.format();
+    ftl.setPipelineDepth(depth);
+    int flashLBAs = ftl.lbaCount();
+
+    uint8_t lba[512];
+    bzero(lba, sizeof(lba));
+    srand(12345);
+    double start = now();
+    for (int i = 0; i < writes; i++) {
+        hostWork(workUS);
+        int x = rand() % flashLBAs;
+        sprintf((char *)lba, "lba %d rewritten at %i", x, i);
+        ftl.write(x, lba);
+    }
+    ftl.drain();
+    double elapsed = now() - start;
+    assert(ftl.check());
+    printf("%6d %10d %12.3f %12.1f\n", depth, writes, elapsed, writes / elapsed);
+}
+
+int main(int argc, char **argv) {
+    int writes = 2000;
+    int eraseUS = 2000;
+    int programUS = 100;
+    int workUS = 200;
+    if (argc > 1) {
+        writes = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        eraseUS = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        programUS = atoi(argv[3]);
+    }
+    if (argc > 4) {
+        workUS = atoi(argv[4]);
+    }
+    printf("%d random writes, erase %dus, program %dus/page, host work %dus/write\n", writes, eraseUS, programUS, workUS);
+    printf("%6s %10s %12s %12s\n", "depth", "writes", "seconds", "writes/s");
+    const int depths[] = {0, 1, 4, 8};
+    for (auto d : depths) {
+        run(d, writes, eraseUS, programUS, workUS);
+    }
+    return 0;
+}
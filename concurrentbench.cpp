@@ -0,0 +1,146 @@
+/*
+    ConcurrentBench.cpp - Readers running alongside a writer with FTL_CONCURRENT_READS
+
+    Copyright (c) 2024 Earle F. Philhower, III <earlephilhower@yahoo.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program. If not, see https://www.gnu.org/licenses/
+*/
+
+// Usage: concurrentbench [writes]
+// One thread overwrites random LBAs (so GC is constantly erasing) while 0..8 others read random runs of 1-8 LBAs and
+// check every sector they get back is one complete version of that LBA, never torn, zeros, or from another LBA.
+
+#define FTL_CONCURRENT_READS 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <cassert>
+#include <chrono>
+#include <list>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <vector>
+
+#include "SPIFTL.h"
+#include "FlashInterfaceRAM.h"
+
+// Keep host file I/O out of the measurement
+class FlashInterfaceRAMNoSave : public FlashInterfaceRAM {
+public:
+    FlashInterfaceRAMNoSave(int size) : FlashInterfaceRAM(size) {
+    }
+
+    virtual void serialize() override {
+    }
+
+    virtual void deserialize() override {
+    }
+};
+
+static double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// <lba:4> <version:4> then (lba ^ version) repeated
+static void fillLBA(uint8_t *b, uint32_t lba, uint32_t version) {
+    memcpy(b, &lba, 4);
+    memcpy(b + 4, &version, 4);
+    memset(b + 8, (lba ^ version) & 0xff, 512 - 8);
+}
+
+static bool checkLBA(const uint8_t *b, uint32_t lba) {
+    uint32_t l, v;
+    memcpy(&l, b, 4);
+    memcpy(&v, b + 4, 4);
+    if (l != lba) {
+        return false;
+    }
+    for (int i = 8; i < 512; i++) {
+        if (b[i] != ((l ^ v) & 0xff)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void run(int readers, int writes) {
+    FlashInterfaceRAMNoSave fi(1024 * 1024);
+    SPIFTL ftl(&fi);
+    ftl.format();
+    ftl.setAutoPersist(false); // Measure the data path, not metadata writes
+    int lbas = ftl.lbaCount() * 3 / 4;
+    uint8_t lba[512];
+    for (int i = 0; i < lbas; i++) {
+        fillLBA(lba, i, 0);
+        ftl.write(i, lba);
+    }
+
+    std::atomic<bool> done(false);
+    std::atomic<uint64_t> reads(0);
+    std::atomic<uint64_t> errors(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < readers; t++) {
+        threads.push_back(std::thread([&, t]() {
+            uint32_t seed = t + 1;
+            uint8_t buff[8 * 512];
+            uint64_t n = 0;
+            while (!done) {
+                int c = 1 + rand_r(&seed) % 8;
+                int i = rand_r(&seed) % (lbas - c);
+                ftl.read(i, buff, c);
+                for (int j = 0; j < c; j++) {
+                    if (!checkLBA(buff + j * 512, i + j)) {
+                        errors++;
+                    }
+                }
+                n += c;
+            }
+            reads += n;
+        }));
+    }
+
+    uint32_t gcBefore = ftl.getStats().gcRuns;
+    uint32_t seed = 12345;
+    double start = now();
+    for (int i = 1; i <= writes; i++) {
+        int l = rand_r(&seed) % lbas;
+        fillLBA(lba, l, i);
+        ftl.write(l, lba);
+    }
+    double elapsed = now() - start;
+    done = true;
+    for (auto &t : threads) {
+        t.join();
+    }
+    assert(ftl.check());
+    printf("%7d %12.0f %12.0f %8u %8llu\n", readers, writes / elapsed, reads / elapsed, ftl.getStats().gcRuns - gcBefore,
+           (unsigned long long)errors);
+}
+
+int main(int argc, char **argv) {
+    int writes = 200000;
+    if (argc > 1) {
+        writes = atoi(argv[1]);
+    }
+    printf("1 MB flash, 75%% used, %d random writes on one thread\n", writes);
+    printf("%7s %12s %12s %8s %8s\n", "readers", "writes/s", "LBAreads/s", "gcRuns", "errors");
+    const int readers[] = {0, 1, 2, 4, 8};
+    for (auto r : readers) {
+        run(r, writes);
+    }
+    return 0;
+}
@@ -0,0 +1,107 @@
+/*
+    GeometryBench.cpp - Compare erase bandwidth and write amplification across LBA/EB sizes
+
+    Copyright (c) 2024 Earle F. Philhower, III <earlephilhower@yahoo.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program. If not, see https://www.gnu.org/licenses/
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <cassert>
+#include <list>
+#include <map>
+
+#include "SPIFTL.h"
+#include "FlashInterfaceSparseRAM.h"
+#include "FlashInterfaceCounter.h"
+
+// Typical W25Q128JV timings, used to model the time the flash itself is busy
+static double eraseMS(int ebBytes) {
+    switch (ebBytes) {
+    case 4096: return 45.0;    // tSE
+    case 32768: return 120.0;  // tBE1
+    case 65536: return 150.0;  // tBE2
+    default: return 45.0 * ebBytes / 4096;
+    }
+}
+static const double programMSPerPage = 0.4; // tPP, 256 byte page
+
+static void run(int flashSize, int ebBytes, int lbaBytes, int passes) {
+    FlashInterfaceSparseRAM ram(flashSize, ebBytes);
+    FlashInterfaceCounter fi(&ram);
+    SPIFTL ftl(&fi, lbaBytes);
+    ftl.format();
+    int flashLBAs = ftl.lbaCount();
+    int lbasPerWrite = 4096 / lbaBytes; // All runs issue the same 4KB host writes
+    int hostWrites = flashLBAs / lbasPerWrite;
+
+    uint8_t lba[4096];
+    bzero(lba, sizeof(lba));
+
+    // Fill the device once so GC has to do real work
+    for (int i = 0; i < hostWrites * lbasPerWrite; i++) {
+        sprintf((char *)lba, "lba %d", i);
+        ftl.write(i, lba);
+    }
+    fi.reset();
+
+    srand(12345);
+    uint64_t hostBytes = 0;
+    for (int i = 0; i < hostWrites * passes; i++) {
+        int x = (rand() % hostWrites) * lbasPerWrite;
+        sprintf((char *)lba, "lba %d rewritten at %i", x, i);
+        for (int j = 0; j < lbasPerWrite; j++) {
+            ftl.write(x + j, lba + j * lbaBytes);
+        }
+        hostBytes += 4096;
+    }
+    assert(ftl.check());
+
+    FlashCounterSnapshot snap = fi.snapshot();
+    FlashCounts c = snap.total();
+    uint64_t metaBytes = snap.category[FlashCategoryMetaPersist].programBytes + snap.category[FlashCategoryMetaAge].programBytes;
+    double eraseTime = c.erases * eraseMS(ebBytes) / 1000.0;
+    double programTime = c.programBytes / 256.0 * programMSPerPage / 1000.0;
+    double erasedMB = (double)c.erases * ebBytes / (1024.0 * 1024.0);
+    printf("%6d %6d %8d %10.3f %8.3f %8.3f %10llu %10.1f %12.2f %12.1f %12.1f\n",
+           ebBytes, lbaBytes, flashLBAs,
+           (double)c.programBytes / hostBytes,
+           (double)snap.category[FlashCategoryGC].programBytes / hostBytes,
+           (double)metaBytes / hostBytes,
+           (unsigned long long)c.erases, erasedMB,
+           erasedMB / eraseTime,
+           (eraseTime + programTime),
+           hostBytes / (1024.0 * (eraseTime + programTime)));
+}
+
+int main(int argc, char **argv) {
+    int flashSize = 4 * 1024 * 1024;
+    int passes = 4;
+    if (argc > 1) {
+        flashSize = atoi(argv[1]) * 1024 * 1024;
+    }
+    if (argc > 2) {
+        passes = atoi(argv[2]);
+    }
+    printf("Random 4KB writes, %d MB flash, %d full-device passes after fill\n", flashSize / (1024 * 1024), passes);
+    printf("%6s %6s %8s %10s %8s %8s %10s %10s %12s %12s %12s\n", "ebSz", "lbaSz", "LBAs", "WAF", "gc", "meta", "erases", "erasedMB", "eraseMB/s", "flashBusy(s)", "hostKB/s");
+    const int geometries[][2] = {{4096, 512}, {4096, 4096}, {32768, 512}, {32768, 4096}, {65536, 512}, {65536, 4096}};
+    for (auto g : geometries) {
+        run(flashSize, g[0], g[1], passes);
+    }
+    return 0;
+}
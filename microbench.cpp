@@ -0,0 +1,216 @@
+/*
+    MicroBench.cpp - Timings of FTL hot paths for tracking regressions between releases
+
+    Copyright (c) 2024 Earle F. Philhower, III <earlephilhower@yahoo.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program. If not, see https://www.gnu.org/licenses/
+*/
+
+// Usage: microbench [--json] [--quick]
+// Emits one CSV line (or JSON object) per benchmark and device size.  All flash is in-memory and sparse, so only
+// FTL CPU time is measured.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <cassert>
+#include <chrono>
+#include <list>
+#include <map>
+
+#include "SPIFTL.h"
+#include "FlashInterfaceSparseRAM.h"
+
+static bool json = false;
+static bool firstResult = true;
+static int scale = 1;
+
+static double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// extra is a per-op secondary metric, i.e. GC runs per write
+static void report(const char *bench, int flashKB, long ops, double secs, double bytesPerOp, double extra) {
+    double nsPerOp = secs * 1e9 / ops;
+    double mbPerSec = bytesPerOp * ops / secs / (1024.0 * 1024.0);
+    if (json) {
+        printf("%s\n  {\"bench\": \"%s\", \"flash_kb\": %d, \"ops\": %ld, \"ns_per_op\": %.1f, \"ops_per_s\": %.1f, \"mb_per_s\": %.2f, \"extra\": %.4f}",
+               firstResult ? "" : ",", bench, flashKB, ops, nsPerOp, ops / secs, mbPerSec, extra);
+    } else {
+        printf("%s,%d,%ld,%.1f,%.1f,%.2f,%.4f\n", bench, flashKB, ops, nsPerOp, ops / secs, mbPerSec, extra);
+    }
+    firstResult = false;
+    fflush(stdout);
+}
+
+static void fill(SPIFTL &ftl, int count) {
+    uint8_t lba[512];
+    bzero(lba, sizeof(lba));
+    for (int i = 0; i < count; i++) {
+        sprintf((char *)lba, "lba %d", i);
+        ftl.write(i, lba);
+    }
+}
+
+static void benchWrites(int flashSize) {
+    FlashInterfaceSparseRAM fi(flashSize);
+    SPIFTL ftl(&fi);
+    uint8_t lba[512];
+    bzero(lba, sizeof(lba));
+
+    ftl.format();
+    int n = ftl.lbaCount();
+    double start = now();
+    for (int i = 0; i < n; i++) {
+        ftl.write(i, lba);
+    }
+    report("write_seq", flashSize / 1024, n, now() - start, 512, 0);
+
+    // Multi-LBA writes, as NBD clients issue them with 4K and 64K block sizes
+    uint8_t *multi = new uint8_t[128 * 512];
+    bzero(multi, 128 * 512);
+    for (int per = 8; per <= 128; per *= 16) {
+        ftl.format();
+        start = now();
+        for (int i = 0; i + per <= n; i += per) {
+            ftl.write(i, multi, per);
+        }
+        char name[32];
+        sprintf(name, "write_seq_x%d", per);
+        report(name, flashSize / 1024, n / per * per, now() - start, 512, 0);
+    }
+    delete[] multi;
+
+    ftl.format();
+    long ops = 20000L * scale;
+    srand(1);
+    start = now();
+    for (long i = 0; i < ops; i++) {
+        ftl.write(rand() % n, lba);
+    }
+    report("write_rand", flashSize / 1024, ops, now() - start, 512, 0);
+
+    start = now();
+    for (long i = 0; i < ops; i++) {
+        ftl.read(rand() % n, lba);
+    }
+    report("read_rand", flashSize / 1024, ops, now() - start, 512, 0);
+
+    // Every trim hits a valid LBA
+    ftl.format();
+    fill(ftl, n);
+    start = now();
+    for (int i = 0; i < n; i++) {
+        ftl.trim((i * 7919) % n);
+    }
+    report("trim", flashSize / 1024, n, now() - start, 0, 0);
+}
+
+// Random overwrites of a partially full device, so garbageCollect() cost depends on how much is still valid
+static void benchGC(int flashSize, int fillPct) {
+    FlashInterfaceSparseRAM fi(flashSize);
+    SPIFTL ftl(&fi);
+    uint8_t lba[512];
+    bzero(lba, sizeof(lba));
+    ftl.format();
+    int n = ftl.lbaCount() * fillPct / 100;
+    fill(ftl, n);
+    uint32_t gcBefore = ftl.getStats().gcRuns;
+    long ops = 20000L * scale;
+    srand(2);
+    double start = now();
+    for (long i = 0; i < ops; i++) {
+        ftl.write(rand() % n, lba);
+    }
+    double secs = now() - start;
+    char name[32];
+    sprintf(name, "gc_fill%d", fillPct);
+    report(name, flashSize / 1024, ops, secs, 512, (double)(ftl.getStats().gcRuns - gcBefore) / ops);
+}
+
+static void benchMetadata(int flashSize) {
+    FlashInterfaceSparseRAM fi(flashSize);
+    SPIFTL ftl(&fi);
+    ftl.format();
+    fill(ftl, ftl.lbaCount() * 3 / 4);
+
+    int ops = 200 * scale;
+    double start = now();
+    for (int i = 0; i < ops; i++) {
+        ftl.persist();
+    }
+    report("persist", flashSize / 1024, ops, now() - start, 0, 0);
+
+    start = now();
+    for (int i = 0; i < ops; i++) {
+        SPIFTL mount(&fi);
+        mount.start();
+    }
+    report("start", flashSize / 1024, ops, now() - start, 0, 0);
+
+    start = now();
+    for (int i = 0; i < ops; i++) {
+        assert(ftl.check());
+    }
+    report("check", flashSize / 1024, ops, now() - start, 0, 0);
+}
+
+static void benchCRC() {
+    uint8_t buff[4096];
+    for (size_t i = 0; i < sizeof(buff); i++) {
+        buff[i] = i * 31;
+    }
+    SPIFTL::MetadataCRC32 crc;
+    int ops = 2000 * scale;
+    volatile uint32_t sink = 0;
+    double start = now();
+    for (int i = 0; i < ops; i++) {
+        crc.reset();
+        crc.add(buff, sizeof(buff));
+        sink += crc.get();
+    }
+    report("crc32_4k", 0, ops, now() - start, sizeof(buff), 0);
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--json")) {
+            json = true;
+        } else if (!strcmp(argv[i], "--quick")) {
+            scale = 0;
+        }
+    }
+    int sizesKB[] = {1024, 4096, 16384};
+    int nsizes = scale ? 3 : 1;
+    scale = scale ? scale : 1;
+    if (json) {
+        printf("[");
+    } else {
+        printf("bench,flash_kb,ops,ns_per_op,ops_per_s,mb_per_s,extra\n");
+    }
+    benchCRC();
+    for (int i = 0; i < nsizes; i++) {
+        int flashSize = sizesKB[i] * 1024;
+        benchWrites(flashSize);
+        benchGC(flashSize, 50);
+        benchGC(flashSize, 75);
+        benchGC(flashSize, 90);
+        benchMetadata(flashSize);
+    }
+    if (json) {
+        printf("\n]\n");
+    }
+    return 0;
+}
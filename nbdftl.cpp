@@ -21,43 +21,446 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <errno.h>
 #include <cassert>
 #include <list>
 #include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
 
+// Reads run in parallel with each other and with the single writer
+#define FTL_CONCURRENT_READS 1
 #include "SPIFTL.h"
 #include "FlashInterfaceRAM.h"
+#include "FlashInterfaceMmap.h"
+#include "FlashInterfaceNORSim.h"
+#include "FlashInterfacePartition.h"
 
 #define NBDKIT_API_VERSION 2
 #include <nbdkit-plugin.h>
-#define THREAD_MODEL NBDKIT_THREAD_MODEL_SERIALIZE_ALL_REQUESTS
+#define THREAD_MODEL NBDKIT_THREAD_MODEL_PARALLEL
 
-FlashInterfaceRAM fi(1 * 1024 * 1024);
-SPIFTL ftl(&fi);
+// Everything is built in config_complete once the parameters are known
+typedef enum { BackendRAM, BackendMmap, BackendSim } Backend;
+static const char *backendName[] = { "ram", "mmap", "sim" };
+static Backend backend = BackendRAM;
+static int64_t flashSize = 1 * 1024 * 1024;
+static int ebBytes = 4096;
+static int lbaBytes = 512;
+static const char *imagePath = "flash.bin";
+static const char *shadowPath = "lba.bin";
+static const uint32_t shadowMagic = 0x48534c46; // "FLSH", then lbaBytes and the LBA count
+
+// flush: metadata is only saved when the client asks (flush or FUA), so batched flushes cost one persist
+// close: flushes are ignored and nothing is saved until nbdkit exits, unsafe but shows the cost of persistence
+typedef enum { PersistAuto, PersistFlush, PersistClose } PersistPolicy;
+static const char *persistPolicyName[] = { "auto", "flush", "close" };
+static PersistPolicy persistPolicy = PersistAuto;
+
+// shards=N splits the flash into N partitions, each with its own FTL and lock, and stripes the device across them
+// an EB's worth of LBAs at a time so connections writing different areas don't serialize on one FTL
+static const int maxShards = 64;
+static int shards = 1;
+static FlashInterface *fi = nullptr;
+static FlashInterface *shardFI[maxShards];
+static SPIFTL *ftl[maxShards];
 
 int flashLBAs;
-uint8_t *lbaCopy;
-
-static void ftl_load(void) {
-    ftl.start();
-    ftl.check();
-    flashLBAs = ftl.lbaCount();
-    lbaCopy = (uint8_t *)calloc(flashLBAs, 512);
-    FILE *f = fopen("lba.bin", "rb");
+
+// 64-bit hash of what every LBA should hold, checked against what the FTL reads back.  Not allocated in "none" mode.
+uint64_t *lbaHash = nullptr;
+static uint64_t zeroHash; // Unmapped LBAs read back as zeros
+
+// FNV-1a over 64-bit words, since LBAs are always a multiple of 8 bytes.  Only needs to catch corruption, not attacks.
+static uint64_t ftl_hash(const uint8_t *data) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < lbaBytes; i += 8) {
+        uint64_t w;
+        memcpy(&w, data + i, 8);
+        h = (h ^ w) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+typedef enum { VerifyNone, VerifyWrite, VerifySample, VerifyFull, VerifyBackground } VerifyMode;
+static const char *verifyModeName[] = { "none", "write", "sample", "full", "background" };
+static VerifyMode verifyMode = VerifySample;
+static int verifySamples = 16;
+static std::atomic<uint32_t> verifyErrors(0);
+
+// Everything except reads holds its shard's lock.  The simulator's virtual clock is shared and counts reads too, so
+// there every request holds the first shard's lock.
+static std::mutex shardMutex[maxShards];
+static std::thread verifyThread;
+static std::atomic<bool> verifyStop(false);
+
+static std::mutex &ftl_mutex(int shard) {
+    return shardMutex[backend == BackendSim ? 0 : shard];
+}
+
+// Flush and close need every shard quiet, always locked in order
+static void ftl_lock_all(void) {
+    for (int i = 0; i < (backend == BackendSim ? 1 : shards); i++) {
+        shardMutex[i].lock();
+    }
+}
+
+static void ftl_unlock_all(void) {
+    for (int i = (backend == BackendSim ? 1 : shards) - 1; i >= 0; i--) {
+        shardMutex[i].unlock();
+    }
+}
+
+// Returns the shard holding a device LBA and its LBA there, and how many LBAs from it on are contiguous in that shard
+static int ftl_shard(int lba, int *local, int *run) {
+    if (shards == 1) {
+        *local = lba;
+        *run = flashLBAs - lba;
+        return 0;
+    }
+    int stripe = ebBytes / lbaBytes;
+    int s = lba / stripe;
+    *local = (s / shards) * stripe + lba % stripe;
+    *run = stripe - lba % stripe;
+    return s % shards;
+}
+
+// Calls fn(shard, localLBA, deviceLBA, count) for each piece of [lba, lba + count) stored contiguously in one shard.
+// fn returns 0 to carry on, 1 to stop early, or -1 on error.
+template<typename F>
+static int ftl_for_each_run(int lba, int count, F fn) {
+    if ((lba < 0) || (count < 0) || (lba + count > flashLBAs)) {
+        return -1;
+    }
+    while (count) {
+        int local, run;
+        int s = ftl_shard(lba, &local, &run);
+        run = std::min(run, count);
+        int ret = fn(s, local, lba, run);
+        if (ret) {
+            return ret < 0 ? -1 : 0;
+        }
+        lba += run;
+        count -= run;
+    }
+    return 0;
+}
+
+// Takes the owning shard's lock, so it can check LBAs which other connections are writing
+static void verify_lba(int lba) {
+    uint8_t tmp[lbaBytes];
+    int local, run;
+    int s = ftl_shard(lba, &local, &run);
+    std::lock_guard<std::mutex> lock(ftl_mutex(s));
+    ftl[s]->read(local, tmp);
+    if (ftl_hash(tmp) != lbaHash[lba]) {
+        fprintf(stderr, "ERROR, lba mismatch %d\n", lba);
+        verifyErrors++;
+    }
+}
+
+// Called after each request which changed [lba, lba + count), without any locks held
+static void verify_range(int lba, int count) {
+    switch (verifyMode) {
+    case VerifyWrite:
+        for (int i = 0; i < count; i++) {
+            verify_lba(lba + i);
+        }
+        break;
+    case VerifySample:
+        for (int i = 0; i < count; i++) {
+            verify_lba(lba + i);
+        }
+        for (int i = 0; i < verifySamples; i++) {
+            verify_lba(rand() % flashLBAs);
+        }
+        break;
+    case VerifyFull:
+        for (int i = 0; i < flashLBAs; i++) {
+            verify_lba(i);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// Continuously walks the whole device, locking per LBA so requests are only held off for a single read
+static void verify_background() {
+    int lba = 0;
+    while (!verifyStop) {
+        verify_lba(lba);
+        lba = (lba + 1) % flashLBAs;
+        if (!lba) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+}
+
+// record=<file> saves every request as "op,sector,count" for the replay tool
+static FILE *recordFile = nullptr;
+
+static void ftl_record(char op, uint64_t offset, uint32_t count) {
+    if (recordFile) {
+        fprintf(recordFile, "%c,%llu,%u\n", op, (unsigned long long)(offset / 512), count / 512);
+    }
+}
+
+// Matches a value against a list of names, returning its index or -1
+static int ftl_config_choice(const char *key, const char *value, const char **names, int count) {
+    for (int i = 0; i < count; i++) {
+        if (!strcmp(value, names[i])) {
+            return i;
+        }
+    }
+    nbdkit_error("unknown %s '%s'", key, value);
+    return -1;
+}
+
+static int ftl_config(const char *key, const char *value) {
+    if (!strcmp(key, "size")) {
+        flashSize = nbdkit_parse_size(value);
+        return flashSize < 0 ? -1 : 0;
+    } else if (!strcmp(key, "eb")) {
+        ebBytes = nbdkit_parse_size(value);
+        return ebBytes < 0 ? -1 : 0;
+    } else if (!strcmp(key, "lba")) {
+        lbaBytes = nbdkit_parse_size(value);
+        return lbaBytes < 0 ? -1 : 0;
+    } else if (!strcmp(key, "backend")) {
+        int b = ftl_config_choice(key, value, backendName, 3);
+        backend = (Backend)b;
+        return b < 0 ? -1 : 0;
+    } else if (!strcmp(key, "image")) {
+        imagePath = strdup(value);
+        return 0;
+    } else if (!strcmp(key, "shadow")) {
+        shadowPath = strdup(value);
+        return 0;
+    } else if (!strcmp(key, "persist")) {
+        int p = ftl_config_choice(key, value, persistPolicyName, 3);
+        persistPolicy = (PersistPolicy)p;
+        return p < 0 ? -1 : 0;
+    } else if (!strcmp(key, "record")) {
+        recordFile = fopen(value, "w");
+        if (!recordFile) {
+            nbdkit_error("unable to open record file '%s'", value);
+            return -1;
+        }
+        return 0;
+    } else if (!strcmp(key, "verify")) {
+        int v = ftl_config_choice(key, value, verifyModeName, VerifyBackground + 1);
+        verifyMode = (VerifyMode)v;
+        return v < 0 ? -1 : 0;
+    } else if (!strcmp(key, "verify-samples")) {
+        verifySamples = atoi(value);
+        if (verifySamples < 0) {
+            nbdkit_error("verify-samples must be >= 0");
+            return -1;
+        }
+        return 0;
+    } else if (!strcmp(key, "shards")) {
+        shards = atoi(value);
+        if ((shards < 1) || (shards > maxShards)) {
+            nbdkit_error("shards must be from 1 to %d", maxShards);
+            return -1;
+        }
+        return 0;
+    }
+    nbdkit_error("unknown parameter '%s'", key);
+    return -1;
+}
+
+static int ftl_config_complete(void) {
+    // Check everything SPIFTL would otherwise assert on
+    if ((lbaBytes < 512) || (lbaBytes & (lbaBytes - 1)) || (ebBytes < lbaBytes) || (ebBytes % lbaBytes)) {
+        nbdkit_error("lba must be a power of 2 >= 512 which evenly divides eb");
+        return -1;
+    }
+    // Also required for nbdkit's preferred block size, and keeps every EB number addressable in the L2P
+    if (ebBytes & (ebBytes - 1)) {
+        nbdkit_error("eb must be a power of 2");
+        return -1;
+    }
+    if ((flashSize < 8 * ebBytes) || (flashSize % ebBytes) || (flashSize > INT32_MAX)) {
+        nbdkit_error("size must be a multiple of eb, at least 8 EBs, and under 2GB");
+        return -1;
+    }
+    if (ebBytes / lbaBytes >= 0xff) {
+        nbdkit_error("eb / lba must be under 255, use a larger lba for this eb");
+        return -1;
+    }
+    if ((flashSize / ebBytes) / shards < 8) {
+        nbdkit_error("each shard needs at least 8 EBs, use fewer shards for this size");
+        return -1;
+    }
+    if (((flashSize / ebBytes) / shards) * (ebBytes / lbaBytes) > 1 << 15) {
+        nbdkit_error("size / shards / lba must be at most 32768, use a larger lba or more shards for this size");
+        return -1;
+    }
+
+    switch (backend) {
+    case BackendRAM:
+        fi = new FlashInterfaceRAM(flashSize, ebBytes, imagePath);
+        break;
+    case BackendMmap:
+        fi = new FlashInterfaceMmap(imagePath, flashSize, ebBytes);
+        if (!fi->size()) {
+            nbdkit_error("unable to map image '%s'", imagePath);
+            return -1;
+        }
+        break;
+    case BackendSim:
+        fi = new FlashInterfaceNORSim(flashSize, W25Q128JVTypical, ebBytes);
+        break;
+    }
+    if (shards == 1) {
+        shardFI[0] = fi;
+    } else {
+        // Partitions can't save or load the shared image themselves, so it's loaded once here and saved for all of
+        // them in ftl_sync, ftl_close, and ftl_save_after_persist
+        fi->deserialize();
+        int ebs = (flashSize / ebBytes) / shards;
+        for (int i = 0; i < shards; i++) {
+            shardFI[i] = new FlashInterfacePartition(fi, i * ebs, ebs);
+        }
+    }
+    for (int i = 0; i < shards; i++) {
+        ftl[i] = new SPIFTL(shardFI[i], lbaBytes);
+        ftl[i]->setAutoPersist(persistPolicy == PersistAuto);
+        ftl[i]->start();
+        ftl[i]->check();
+    }
+    // Every shard is the same size, trimmed to whole stripes
+    int stripe = ebBytes / lbaBytes;
+    flashLBAs = (shards == 1) ? ftl[0]->lbaCount() : shards * (ftl[0]->lbaCount() / stripe) * stripe;
+
+    if (verifyMode == VerifyNone) {
+        return 0;
+    }
+    uint8_t zeros[lbaBytes];
+    bzero(zeros, lbaBytes);
+    zeroHash = ftl_hash(zeros);
+    lbaHash = new uint64_t[flashLBAs];
+    // The simulator starts blank every time, so old hashes would never match.  Hashes saved with a different
+    // geometry (or an old full shadow copy) are ignored too.
+    FILE *f = (backend != BackendSim) ? fopen(shadowPath, "rb") : nullptr;
+    uint32_t hdr[3];
+    bool loaded = f && (fread(hdr, sizeof(hdr), 1, f) == 1) && (hdr[0] == shadowMagic) && (hdr[1] == (uint32_t)lbaBytes) &&
+                  (hdr[2] == (uint32_t)flashLBAs) && (fread(lbaHash, sizeof(uint64_t), flashLBAs, f) == (size_t)flashLBAs);
     if (f) {
-        fread(lbaCopy, 512, flashLBAs, f);
         fclose(f);
     }
-    ftl.check();
+    if (!loaded) {
+        for (int i = 0; i < flashLBAs; i++) {
+            lbaHash[i] = zeroHash;
+        }
+    }
+    return 0;
 }
 
-static void ftl_close(void *handle) {
-    ftl.persist();
-    FILE *f = fopen("lba.bin", "wb");
+// Threads don't survive nbdkit's daemonizing fork, so start the verifier here
+static int ftl_after_fork(void) {
+    if (verifyMode == VerifyBackground) {
+        verifyThread = std::thread(verify_background);
+    }
+    return 0;
+}
+
+#if FTL_TRACE
+static void ftl_trace_out(const void *data, int len, void *arg) {
+    fwrite(data, 1, len, (FILE *)arg);
+}
+#endif
+
+// Connections come and go (several at once with multi-conn), so the final save and the side files are written once
+// here when nbdkit exits
+static void ftl_unload(void) {
+    if (verifyThread.joinable()) {
+        verifyStop = true;
+        verifyThread.join();
+    }
+    if (verifyErrors) {
+        fprintf(stderr, "ERROR, %u lba mismatches found\n", (unsigned)verifyErrors);
+    }
+    for (int i = 0; i < shards; i++) {
+        if (ftl[i]) {
+            ftl[i]->persist();
+        }
+    }
+    if (ftl[0] && (shards > 1)) {
+        fi->serialize();
+    }
+    FILE *f = lbaHash ? fopen(shadowPath, "wb") : nullptr;
     if (f) {
-        fwrite(lbaCopy, 512, flashLBAs, f);
+        uint32_t hdr[3] = {shadowMagic, (uint32_t)lbaBytes, (uint32_t)flashLBAs};
+        fwrite(hdr, sizeof(hdr), 1, f);
+        fwrite(lbaHash, sizeof(uint64_t), flashLBAs, f);
         fclose(f);
     }
+    if (recordFile) {
+        fclose(recordFile);
+    }
+#if FTL_TRACE
+    // Decode with tracedecode, one file per shard after the first
+    for (int i = 0; (i < shards) && ftl[i]; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), i ? "trace.%d.bin" : "trace.bin", i);
+        f = fopen(name, "wb");
+        if (f) {
+            ftl[i]->dumpTrace(ftl_trace_out, f);
+            fclose(f);
+        }
+    }
+#endif
+    delete[] lbaHash;
+    for (int i = 0; i < shards; i++) {
+        delete ftl[i];
+        if (shardFI[i] != fi) {
+            delete shardFI[i];
+        }
+    }
+    delete fi;
+}
+
+// Call with ftl_lock_all() held
+static int ftl_sync(void) {
+    if (persistPolicy != PersistClose) {
+        for (int i = 0; i < shards; i++) {
+            ftl[i]->persistIfDirty();
+        }
+        if (shards > 1) {
+            fi->serialize();
+        }
+    }
+    return 0;
+}
+
+static int ftl_sync_all(void) {
+    ftl_lock_all();
+    int ret = ftl_sync();
+    ftl_unlock_all();
+    return ret;
+}
+
+// A disconnecting client gets the same durability as a flush, everything else waits for ftl_unload
+static void ftl_close(void *handle) {
+    ftl_sync_all();
+    if (recordFile) {
+        fflush(recordFile);
+    }
+}
+
+// Partitions can't save the shared image themselves, so once a shard has persisted on its own (persist=auto) save it
+// for them here, with every shard quiet, to keep the same durability as a single FTL
+static void ftl_save_after_persist(bool persisted) {
+    if (persisted && (shards > 1)) {
+        ftl_lock_all();
+        fi->serialize();
+        ftl_unlock_all();
+    }
 }
 
 static void *ftl_open(int readonly) {
@@ -65,44 +468,74 @@ static void *ftl_open(int readonly) {
 }
 
 static int64_t ftl_get_size(void *handle) {
-    return (int64_t)flashLBAs * 512;
+    return (int64_t)flashLBAs * lbaBytes;
+}
+
+// Partial LBAs would otherwise be silently truncated, so refuse them.  Clients can ignore the advertised block size.
+static bool ftl_aligned(uint32_t count, uint64_t offset) {
+    if ((offset % lbaBytes) || (count % lbaBytes)) {
+        nbdkit_error("request not aligned to %d byte LBAs", lbaBytes);
+        nbdkit_set_error(EINVAL);
+        return false;
+    }
+    return true;
 }
 
 static int ftl_pwrite(void *handle, const void *buf, uint32_t count, uint64_t offset, uint32_t flags) {
-    uint8_t *b = (uint8_t*)buf;
-    while (count) {
-        int lba = offset / 512;
-        ftl.write(lba, b);
-        memcpy(lbaCopy + lba * 512, b, 512);
-        for (int i = 0; i < flashLBAs; i++) {
-            uint8_t tmp[512];
-            ftl.read(i, tmp);
-            if (memcmp(tmp, lbaCopy + i * 512, 512)) {
-                fprintf(stderr, "ERROR, lba mismatch %d\n", i);
-            }
+    ftl_record('W', offset, count);
+    if (!ftl_aligned(count, offset)) {
+        return -1;
+    }
+    int first = offset / lbaBytes;
+    int lbas = count / lbaBytes;
+    bool persisted = false;
+    int ret = ftl_for_each_run(first, lbas, [buf, first, &persisted](int s, int local, int lba, int run) {
+        const uint8_t *src = (const uint8_t *)buf + (size_t)(lba - first) * lbaBytes;
+        std::lock_guard<std::mutex> lock(ftl_mutex(s));
+        uint32_t persists = ftl[s]->getStats().persists;
+        if (!ftl[s]->write(local, src, run)) {
+            return -1;
+        }
+        persisted |= ftl[s]->getStats().persists != persists;
+        for (int i = 0; lbaHash && (i < run); i++) {
+            lbaHash[lba + i] = ftl_hash(src + (size_t)i * lbaBytes);
         }
-        b += 512;
-        offset += 512;
-        count -= 512;
+        return 0;
+    });
+    ftl_save_after_persist(persisted);
+    if (ret) {
+        nbdkit_error("write out of range");
+        return -1;
     }
-    return 0;
+    verify_range(first, lbas);
+    return (flags & NBDKIT_FLAG_FUA) ? ftl_sync_all() : 0;
 }
 
 static int ftl_pread(void *handle, void *buf, uint32_t count, uint64_t offset, uint32_t flags) {
-    uint8_t *b = (uint8_t*)buf;
-    while (count) {
-        int lba = offset / 512;
-        ftl.read(lba, b);
-        offset += 512;
-        count -= 512;
+    ftl_record('R', offset, count);
+    if (!ftl_aligned(count, offset)) {
+        return -1;
+    }
+    int first = offset / lbaBytes;
+    int ret = ftl_for_each_run(first, count / lbaBytes, [buf, first](int s, int local, int lba, int run) {
+        std::unique_lock<std::mutex> lock(ftl_mutex(s), std::defer_lock);
+        if (backend == BackendSim) {
+            lock.lock();
+        }
+        return ftl[s]->read(local, (uint8_t *)buf + (size_t)(lba - first) * lbaBytes, run) ? 0 : -1;
+    });
+    if (ret) {
+        nbdkit_error("read out of range");
+        return -1;
     }
     return 0;
 }
 
+// Whole-EB requests let the FTL fill an EB with a single program, and larger ones are handled natively too
 static int ftl_block_size(void *handle, uint32_t *minimum, uint32_t *preferred, uint32_t *maximum) {
-    *minimum = 512;
-    *preferred = 512;
-    *maximum = 512;
+    *minimum = lbaBytes;
+    *preferred = ebBytes;
+    *maximum = 32 * 1024 * 1024;
     return 0;
 }
 
@@ -110,29 +543,144 @@ static int ftl_can_trim(void *handle) {
     return 1;
 }
 
-static int ftl_trim(void *handle, uint32_t count, uint64_t offset, uint32_t flags) {
-    while (count) {
-        int lba = offset / 512;
-        ftl.trim(lba);
-        offset += 512;
-        count -= 512;
+static int ftl_can_flush(void *handle) {
+    return 1;
+}
+
+static int ftl_can_fua(void *handle) {
+    return NBDKIT_FUA_NATIVE;
+}
+
+static int ftl_flush(void *handle, uint32_t flags) {
+    return ftl_sync_all();
+}
+
+// Trim and zero both just unmap the range, as a single FTL call per shard run so it's one metadata change however big
+// it is
+static int ftl_unmap(uint32_t count, uint64_t offset, uint32_t flags) {
+    ftl_record('T', offset, count);
+    if (!ftl_aligned(count, offset)) {
+        return -1;
     }
+    int first = offset / lbaBytes;
+    int lbas = count / lbaBytes;
+    bool persisted = false;
+    int ret = ftl_for_each_run(first, lbas, [&persisted](int s, int local, int lba, int run) {
+        std::lock_guard<std::mutex> lock(ftl_mutex(s));
+        uint32_t persists = ftl[s]->getStats().persists;
+        if (!ftl[s]->trim(local, run)) {
+            return -1;
+        }
+        persisted |= ftl[s]->getStats().persists != persists;
+        for (int i = 0; lbaHash && (i < run); i++) {
+            lbaHash[lba + i] = zeroHash;
+        }
+        return 0;
+    });
+    ftl_save_after_persist(persisted);
+    if (ret) {
+        nbdkit_error("trim out of range");
+        return -1;
+    }
+    verify_range(first, lbas);
+    return (flags & NBDKIT_FLAG_FUA) ? ftl_sync_all() : 0;
+}
+
+static int ftl_trim(void *handle, uint32_t count, uint64_t offset, uint32_t flags) {
+    return ftl_unmap(count, offset, flags);
+}
+
+static int ftl_can_zero(void *handle) {
+    return 1;
+}
+
+// Zeroing is only ever an L2P update, so it's always fast
+static int ftl_can_fast_zero(void *handle) {
+    return 1;
+}
+
+// Unmapped LBAs read back as zeros, so zeroing is trimming
+static int ftl_zero(void *handle, uint32_t count, uint64_t offset, uint32_t flags) {
+    return ftl_unmap(count, offset, flags);
+}
+
+static int ftl_can_extents(void *handle) {
+    return 1;
+}
+
+// Unmapped LBAs are holes which read as zeros, so copy and backup tools can skip them
+static int ftl_extents(void *handle, uint32_t count, uint64_t offset, uint32_t flags, struct nbdkit_extents *extents) {
+    int first = offset / lbaBytes;
+    int end = (offset + count + lbaBytes - 1) / lbaBytes;
+    // nbdkit merges matching extents from neighbouring shard runs
+    return ftl_for_each_run(first, end - first, [extents, flags](int s, int local, int lba, int run) {
+        std::lock_guard<std::mutex> lock(ftl_mutex(s));
+        while (run) {
+            bool mapped;
+            int n = ftl[s]->extent(local, run, &mapped);
+            if (nbdkit_add_extent(extents, (uint64_t)lba * lbaBytes, (uint64_t)n * lbaBytes, mapped ? 0 : NBDKIT_EXTENT_HOLE | NBDKIT_EXTENT_ZERO)) {
+                return -1;
+            }
+            if (flags & NBDKIT_FLAG_REQ_ONE) {
+                return 1;
+            }
+            local += n;
+            lba += n;
+            run -= n;
+        }
+        return 0;
+    });
+}
+
+// Every connection sees the same FTLs and flush saves all of them, so clients may spread requests over connections
+static int ftl_can_multi_conn(void *handle) {
     return 1;
 }
 
 static struct nbdkit_plugin plugin = {
     .name              = "spiftl",
     .version           = "1.0",
-    .load              = ftl_load,
+    .unload            = ftl_unload,
+    .config            = ftl_config,
+    .config_complete   = ftl_config_complete,
+    .config_help       = "size=<SIZE>     Flash size (1M)\n"
+                         "eb=<SIZE>       Erase block size (4K)\n"
+                         "lba=<SIZE>      Sector size, power of 2 from 512 to eb (512)\n"
+                         "backend=ram|mmap|sim\n"
+                         "                Flash held in RAM and saved on persist, a mapped image file, or the\n"
+                         "                W25Q128JV timing simulator with nothing saved\n"
+                         "image=<FILE>    Flash image for the ram and mmap backends (flash.bin)\n"
+                         "shadow=<FILE>   Where the verify LBA hashes are kept between runs (lba.bin)\n"
+                         "persist=auto|flush|close\n"
+                         "                Save FTL metadata every 256 writes, on flush/FUA/disconnect and at exit\n"
+                         "                (auto), only on flush/FUA/disconnect and at exit (flush), or only at\n"
+                         "                exit (close)\n"
+                         "record=<FILE>   Save all requests to FILE for replay\n"
+                         "verify=none|write|sample|full|background\n"
+                         "                Check FTL reads against per-LBA hashes: never, just the LBAs\n"
+                         "                changed, those plus verify-samples random LBAs (default), the\n"
+                         "                whole device after every request, or continuously on a thread\n"
+                         "verify-samples=<N>  Random LBAs checked per request in sample mode (16)\n"
+                         "shards=<N>      Independent FTLs the flash is split between, each with its own lock (1)",
     .open              = ftl_open,
     .close             = ftl_close,
     .get_size          = ftl_get_size,
 
+    .can_flush         = ftl_can_flush,
     .can_trim          = ftl_can_trim,
+    .can_zero          = ftl_can_zero,
+    .can_fua           = ftl_can_fua,
 
     .pread             = ftl_pread,
     .pwrite            = ftl_pwrite,
+    .flush             = ftl_flush,
     .trim              = ftl_trim,
+    .zero              = ftl_zero,
+    .can_multi_conn    = ftl_can_multi_conn,
+    .can_extents       = ftl_can_extents,
+    .extents           = ftl_extents,
+    .can_fast_zero     = ftl_can_fast_zero,
+    .after_fork        = ftl_after_fork,
     .block_size        = ftl_block_size
 };
 
@@ -0,0 +1,88 @@
+/*
+    NORSimBench.cpp - Predict FTL write latency on real NOR parts using the timing simulator
+
+    Copyright (c) 2024 Earle F. Philhower, III <earlephilhower@yahoo.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program. If not, see https://www.gnu.org/licenses/
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <cassert>
+#include <list>
+#include <map>
+
+#include "SPIFTL.h"
+#include "FlashInterfaceNORSim.h"
+
+static void run(const NORFlashProfile &profile, int flashSize, int ebSize, int depth, int writes) {
+    FlashInterfaceNORSim fi(flashSize, profile, ebSize);
+    SPIFTL ftl(&fi);
+    ftl.format();
+    ftl.setPipelineDepth(depth);
+    int flashLBAs = ftl.lbaCount();
+
+    uint8_t lba[512];
+    bzero(lba, sizeof(lba));
+    // Mostly full device, so GC has real work to do
+    for (int i = 0; i < flashLBAs * 3 / 4; i++) {
+        sprintf((char *)lba, "lba %d initial", i);
+        ftl.write(i, lba);
+    }
+    ftl.drain();
+
+    NORSimHistogram lat;
+    srand(12345);
+    uint64_t start = fi.now();
+    for (int i = 0; i < writes; i++) {
+        int x = rand() % (flashLBAs * 3 / 4);
+        sprintf((char *)lba, "lba %d rewritten at %i", x, i);
+        uint64_t t = fi.now();
+        ftl.write(x, lba);
+        lat.add(fi.now() - t);
+    }
+    ftl.drain();
+    double elapsed = (fi.now() - start) / 1e9;
+    assert(ftl.check());
+    assert(!fi.violations());
+    printf("%-14s %6d %6d %10.1f %10.1f %10.1f %10.1f %10.1f\n", profile.name, ebSize / 1024, depth,
+           lat.percentile(50) / 1000.0, lat.percentile(99) / 1000.0, lat.percentile(99.9) / 1000.0,
+           lat.percentile(100) / 1000.0, writes / elapsed);
+}
+
+int main(int argc, char **argv) {
+    int flashSize = 1024 * 1024;
+    int writes = 20000;
+    if (argc > 1) {
+        flashSize = atoi(argv[1]) * 1024;
+    }
+    if (argc > 2) {
+        writes = atoi(argv[2]);
+    }
+    printf("%d KB flash, 75%% full, %d random 512b writes, latencies in virtual microseconds\n", flashSize / 1024, writes);
+    printf("%-14s %6s %6s %10s %10s %10s %10s %10s\n", "part", "EB(KB)", "depth", "p50", "p99", "p99.9", "max", "writes/s");
+    const NORFlashProfile *profiles[] = {&W25Q128JVTypical, &W25Q128JVMax};
+    const int ebSizes[] = {4096, 65536};
+    const int depths[] = {0, 4};
+    for (auto p : profiles) {
+        for (auto eb : ebSizes) {
+            for (auto d : depths) {
+                run(*p, flashSize, eb, d, writes);
+            }
+        }
+    }
+    return 0;
+}
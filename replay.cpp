@@ -0,0 +1,262 @@
+/*
+    Replay.cpp - Drive SPIFTL with a recorded block I/O trace and report how it held up
+
+    Copyright (c) 2024 Earle F. Philhower, III <earlephilhower@yahoo.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program. If not, see https://www.gnu.org/licenses/
+*/
+
+// Usage: replay [--backend=sparse|ram|nor] [--size=MB] [--eb=bytes] [--lba=bytes] [--ebs] <trace>
+//
+// Trace formats are detected automatically, offsets and counts are in 512 byte sectors unless noted:
+//   CSV:      op,sector,count       op is W/R/T (or write/read/trim), as recorded by nbdftl's record= option
+//   fio:      iolog v2 or v3        "[time] file read|write|trim offset length", bytes
+//   blkparse: default text output   only Q (queued) events, RWBS W/R/D
+// Anything past the end of the simulated device wraps around.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <cassert>
+#include <chrono>
+#include <list>
+#include <map>
+#include <vector>
+
+#include "SPIFTL.h"
+#include "FlashInterfaceRAM.h"
+#include "FlashInterfaceSparseRAM.h"
+#include "FlashInterfaceNORSim.h"
+#include "FlashInterfaceCounter.h"
+
+// The replay starts from a fresh format every time, so never load or overwrite an image on disk
+class FlashInterfaceRAMNoSave : public FlashInterfaceRAM {
+public:
+    FlashInterfaceRAMNoSave(int size, int ebSize) : FlashInterfaceRAM(size, ebSize) {
+    }
+
+    virtual void serialize() override {
+    }
+
+    virtual void deserialize() override {
+    }
+};
+
+// Adds per-EB erase counts to the category totals
+class FlashInterfaceEBCounter : public FlashInterfaceCounter {
+public:
+    FlashInterfaceEBCounter(FlashInterface *fi) : FlashInterfaceCounter(fi), ebErases(fi->size() / fi->eraseBlockSize()) {
+    }
+
+    virtual bool eraseBlock(int eb) override {
+        ebErases[eb]++;
+        return FlashInterfaceCounter::eraseBlock(eb);
+    }
+
+    virtual bool startErase(int eb, FlashCallback cb, void *arg) override {
+        ebErases[eb]++;
+        return FlashInterfaceCounter::startErase(eb, cb, arg);
+    }
+
+    std::vector<uint32_t> ebErases;
+};
+
+typedef struct {
+    char op;                // 'W', 'R', 'T'
+    uint64_t sector;
+    uint32_t count;
+} TraceOp;
+
+// Returns false for lines which aren't I/O (headers, comments, other blkparse events)
+static bool parseLine(const char *line, TraceOp *op) {
+    char a[64], b[64], c[64];
+    unsigned long long x, y;
+    // blkparse: "8,0 3 1 0.000000000 697 Q WS 1234 + 8 [proc]"
+    if ((sscanf(line, " %*d,%*d %*d %*u %*f %*d %63s %63s %llu + %llu", a, b, &x, &y) == 4)) {
+        if (strcmp(a, "Q")) {
+            return false;
+        }
+        op->op = strchr(b, 'D') ? 'T' : strchr(b, 'W') ? 'W' : strchr(b, 'R') ? 'R' : 0;
+        op->sector = x;
+        op->count = y;
+        return op->op && y;
+    }
+    // CSV: "W,1234,8"
+    if (sscanf(line, " %63[A-Za-z] , %llu , %llu", a, &x, &y) == 3) {
+        op->op = toupper(a[0]) == 'D' ? 'T' : toupper(a[0]);
+        op->sector = x;
+        op->count = y;
+        return strchr("WRT", op->op) && y;
+    }
+    // fio iolog v3 "time file action offset length" or v2 "file action offset length"
+    int n = sscanf(line, " %63s %63s %63s %llu %llu", a, b, c, &x, &y);
+    const char *action = nullptr;
+    if (n == 5) {
+        action = c;
+    } else if ((n == 4) && (sscanf(line, " %63s %63s %llu %llu", a, b, &x, &y) == 4)) {
+        action = b;
+    }
+    if (action) {
+        op->op = !strcmp(action, "write") ? 'W' : !strcmp(action, "read") ? 'R' : !strcmp(action, "trim") ? 'T' : 0;
+        op->sector = x / 512;
+        op->count = (y + 511) / 512;
+        return op->op && op->count;
+    }
+    return false;
+}
+
+static double wallClock() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int main(int argc, char **argv) {
+    const char *backend = "sparse";
+    int sizeMB = 16;
+    int ebBytes = 4096;
+    int lbaBytes = 512;
+    bool showEBs = false;
+    const char *path = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "--backend=", 10)) {
+            backend = argv[i] + 10;
+        } else if (!strncmp(argv[i], "--size=", 7)) {
+            sizeMB = atoi(argv[i] + 7);
+        } else if (!strncmp(argv[i], "--eb=", 5)) {
+            ebBytes = atoi(argv[i] + 5);
+        } else if (!strncmp(argv[i], "--lba=", 6)) {
+            lbaBytes = atoi(argv[i] + 6);
+        } else if (!strcmp(argv[i], "--ebs")) {
+            showEBs = true;
+        } else {
+            path = argv[i];
+        }
+    }
+    FILE *f = path ? fopen(path, "r") : nullptr;
+    if (!f) {
+        fprintf(stderr, "Usage: %s [--backend=sparse|ram|nor] [--size=MB] [--eb=bytes] [--lba=bytes] [--ebs] <trace>\n", argv[0]);
+        return 1;
+    }
+
+    int flashSize = sizeMB * 1024 * 1024;
+    FlashInterface *raw;
+    FlashInterfaceNORSim *nor = nullptr;
+    if (!strcmp(backend, "ram")) {
+        raw = new FlashInterfaceRAMNoSave(flashSize, ebBytes);
+    } else if (!strcmp(backend, "nor")) {
+        raw = nor = new FlashInterfaceNORSim(flashSize, W25Q128JVTypical, ebBytes);
+    } else {
+        raw = new FlashInterfaceSparseRAM(flashSize, ebBytes);
+    }
+    FlashInterfaceEBCounter fi(raw);
+    SPIFTL *ftl = new SPIFTL(&fi, lbaBytes);
+    ftl->format();
+    int flashLBAs = ftl->lbaCount();
+    int sectorsPerLBA = lbaBytes / 512;
+    std::vector<uint8_t> buff; // Grows to the largest request
+
+    // Time is virtual on the NOR simulator so it reflects the real part, otherwise it's host CPU time
+    auto clock = [&]() -> double {
+        return nor ? nor->now() / 1e9 : wallClock();
+    };
+
+    NORSimHistogram stalls; // Only its percentile math is needed, the unit is whatever we give it (ns)
+    uint64_t ops[128] = {};
+    uint64_t sectors[128] = {};
+    uint64_t wrapped = 0;
+    char line[512];
+    TraceOp op;
+    double start = clock();
+    while (fgets(line, sizeof(line), f)) {
+        if (!parseLine(line, &op)) {
+            continue;
+        }
+        ops[(int)op.op]++;
+        sectors[(int)op.op] += op.count;
+        // Sub-LBA requests act on the whole LBA they touch.  Each request is one multi-LBA FTL call like the NBD
+        // plugin makes, split only where it wraps past the end of the device.
+        uint64_t first = op.sector / sectorsPerLBA;
+        uint64_t end = (op.sector + op.count - 1) / sectorsPerLBA + 1;
+        for (uint64_t l = first; l < end;) {
+            int x = l % flashLBAs;
+            int run = (int)std::min<uint64_t>(end - l, flashLBAs - x);
+            wrapped += l >= (uint64_t)flashLBAs ? run : 0;
+            if ((size_t)run * lbaBytes > buff.size()) {
+                buff.resize((size_t)run * lbaBytes);
+            }
+            if (op.op == 'W') {
+                for (int i = 0; i < run; i++) {
+                    sprintf((char *)&buff[(size_t)i * lbaBytes], "lba %d", x + i);
+                }
+                uint32_t before = ftl->getStats().gcStalls;
+                double t = clock();
+                ftl->write(x, buff.data(), run);
+                if (ftl->getStats().gcStalls != before) {
+                    stalls.add((uint64_t)((clock() - t) * 1e9));
+                }
+            } else if (op.op == 'R') {
+                ftl->read(x, buff.data(), run);
+            } else {
+                ftl->trim(x, run);
+            }
+            l += run;
+        }
+    }
+    fclose(f);
+    ftl->persist();
+    double elapsed = clock() - start;
+    assert(ftl->check());
+
+    FlashCounterSnapshot snap = fi.snapshot();
+    FlashCounts total = snap.total();
+    double hostMB = (sectors['W'] + sectors['R']) / 2048.0;
+    printf("trace %s on %s, %d MB flash, %d byte EBs, %d byte LBAs\n", path, backend, sizeMB, ebBytes, lbaBytes);
+    printf("ops: %llu writes (%.1f MB), %llu reads (%.1f MB), %llu trims (%.1f MB)\n",
+           (unsigned long long)ops['W'], sectors['W'] / 2048.0, (unsigned long long)ops['R'], sectors['R'] / 2048.0,
+           (unsigned long long)ops['T'], sectors['T'] / 2048.0);
+    if (wrapped) {
+        printf("warning: %llu LBAs beyond the %d LBA device wrapped around\n", (unsigned long long)wrapped, flashLBAs);
+    }
+    printf("time: %.3f s %s, %.1f ops/s, %.2f MB/s\n", elapsed, nor ? "virtual" : "host",
+           (ops['W'] + ops['R'] + ops['T']) / elapsed, hostMB / elapsed);
+    printf("WAF: %.3f (gc %.3f, metadata %.3f)\n", snap.writeAmplification(),
+           snap.category[FlashCategoryHost].programBytes ? (double)snap.category[FlashCategoryGC].programBytes / snap.category[FlashCategoryHost].programBytes : 0.0,
+           snap.category[FlashCategoryHost].programBytes ? (double)(snap.category[FlashCategoryMetaPersist].programBytes + snap.category[FlashCategoryMetaAge].programBytes) / snap.category[FlashCategoryHost].programBytes : 0.0);
+    printf("erases: %u total (host %u, gc %u, metadata %u, metadata age %u)\n", total.erases,
+           snap.category[FlashCategoryHost].erases, snap.category[FlashCategoryGC].erases,
+           snap.category[FlashCategoryMetaPersist].erases, snap.category[FlashCategoryMetaAge].erases);
+    printf("gc stalls: %zu, p50 %.1f us, p99 %.1f us, max %.1f us\n", stalls.count(), stalls.percentile(50) / 1000.0,
+           stalls.percentile(99) / 1000.0, stalls.percentile(100) / 1000.0);
+
+    uint32_t minE = ~0U, maxE = 0;
+    for (auto e : fi.ebErases) {
+        minE = std::min(minE, e);
+        maxE = std::max(maxE, e);
+    }
+    int minPE = 255, maxPE = 0;
+    for (int i = 0; i < ftl->ebCount(); i++) {
+        minPE = std::min(minPE, (int)ftl->getPECount(i));
+        maxPE = std::max(maxPE, (int)ftl->getPECount(i));
+    }
+    printf("per-EB erases: min %u max %u, final PE spread %d (limit %d)\n", minE, maxE, maxPE - minPE, ftl->maxPEDiff);
+    if (showEBs) {
+        for (size_t i = 0; i < fi.ebErases.size(); i++) {
+            printf("  eb %zu: %u erases\n", i, fi.ebErases[i]);
+        }
+    }
+
+    delete ftl;
+    delete raw;
+    return 0;
+}
@@ -0,0 +1,95 @@
+/*
+    ScaleBench.cpp - Mount, persist, and GC cost versus device size using sparse flash emulation
+
+    Copyright (c) 2024 Earle F. Philhower, III <earlephilhower@yahoo.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program. If not, see https://www.gnu.org/licenses/
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <cassert>
+#include <chrono>
+#include <list>
+#include <map>
+
+#include "SPIFTL.h"
+#include "FlashInterfaceSparseRAM.h"
+
+static double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void run(int flashSize, int fillPct, int writes) {
+    // LBAs are limited to 32768, so grow them along with the device
+    int lbaSize = 512;
+    while (flashSize / lbaSize > 32768) {
+        lbaSize *= 2;
+    }
+    FlashInterfaceSparseRAM fi(flashSize);
+    uint8_t *lba = new uint8_t[lbaSize];
+    bzero(lba, lbaSize);
+    int flashLBAs;
+    double persistTime;
+    {
+        SPIFTL ftl(&fi, lbaSize);
+        ftl.format();
+        flashLBAs = ftl.lbaCount();
+        for (int i = 0; i < flashLBAs * fillPct / 100; i++) {
+            sprintf((char *)lba, "lba %d initial", i);
+            ftl.write(i, lba);
+        }
+        double start = now();
+        ftl.persist();
+        persistTime = now() - start;
+    }
+
+    SPIFTL ftl(&fi, lbaSize);
+    double start = now();
+    ftl.start();
+    double mountTime = now() - start;
+
+    srand(12345);
+    start = now();
+    for (int i = 0; i < writes; i++) {
+        int x = rand() % (flashLBAs * fillPct / 100);
+        sprintf((char *)lba, "lba %d rewritten at %i", x, i);
+        ftl.write(x, lba);
+    }
+    double writeTime = now() - start;
+    assert(ftl.check());
+    printf("%8d %6d %8d %10.3f %10.3f %12.0f %10.1f\n", flashSize / (1024 * 1024), lbaSize, flashLBAs, mountTime * 1000.0,
+           persistTime * 1000.0, writes / writeTime, fi.residentBytes() / (1024.0 * 1024.0));
+    delete[] lba;
+}
+
+int main(int argc, char **argv) {
+    int fillPct = 75;
+    int writes = 20000;
+    if (argc > 1) {
+        fillPct = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        writes = atoi(argv[2]);
+    }
+    printf("%d%% full, %d random writes after mount\n", fillPct, writes);
+    printf("%8s %6s %8s %10s %10s %12s %10s\n", "MB", "LBA", "LBAs", "mount(ms)", "persist(ms)", "writes/s", "RSS(MB)");
+    const int sizes[] = {1, 4, 16, 64, 128};
+    for (auto s : sizes) {
+        run(s * 1024 * 1024, fillPct, writes);
+    }
+    return 0;
+}
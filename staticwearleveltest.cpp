@@ -41,6 +41,7 @@ int main(int argc, char **argv) {
         rv = atol(argv[1]);
     }
     printf("Starting FTL, random seed %d\n", rv);
+    srand(rv);
 
     ftl.start();
     ftl.check();
@@ -0,0 +1,90 @@
+/*
+    TraceDecode.cpp - Print a binary SPIFTL trace saved with SPIFTL::dumpTrace()
+
+    Copyright (c) 2024 Earle F. Philhower, III <earlephilhower@yahoo.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program. If not, see https://www.gnu.org/licenses/
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <cassert>
+#include <list>
+#include <map>
+
+#include "SPIFTL.h"
+
+// Indexed by FTLTraceEvent.  Formats only use plain %u conversions, filled from the event's a, b, and c fields in the
+// order given.  Any fields a format doesn't mention come last, where printf ignores them.
+typedef struct {
+    const char *format;
+    const char *args;
+} EventFormat;
+
+static const EventFormat eventFormat[FTLTraceEvents] = {
+    {"format", "abc"},
+    {"format erasing old metadata eb %u", "bac"},
+    {"start, restored epoch %u", "bac"},
+    {"write lba %u to eb %u idx %u", "abc"},
+    {"trim lba %u from eb %u idx %u", "abc"},
+    {"free eb %u", "bac"},
+    {"erase eb %u, pe %u", "bca"},
+    {"select eb %u for writing", "bac"},
+    {"gc eb %u (score %u) into eb %u", "bac"},
+    {"  move lba %u to eb %u idx %u", "abc"},
+    {"persist epoch %u", "bac"},
+    {"metadata free eb %u", "bac"},
+    {"metadata allocate eb %u", "bac"},
+    {"metadata aged out eb %u to eb %u", "bca"},
+};
+
+static unsigned eventField(const FTLTraceEntry &e, char field) {
+    return field == 'a' ? (unsigned)e.a : field == 'b' ? (unsigned)e.b : (unsigned)e.c;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <trace.bin>\n", argv[0]);
+        return 1;
+    }
+    FILE *f = fopen(argv[1], "rb");
+    if (!f) {
+        perror(argv[1]);
+        return 1;
+    }
+    FTLTraceHeader h;
+    if ((fread(&h, sizeof(h), 1, f) != 1) || memcmp(h.sig, "FTLTRC01", 8) || (h.entrySize != sizeof(FTLTraceEntry))) {
+        fprintf(stderr, "%s: not a SPIFTL trace\n", argv[1]);
+        fclose(f);
+        return 1;
+    }
+    printf("%u events, %u oldest lost\n", h.count, h.total - h.count);
+    FTLTraceEntry e;
+    uint32_t last = 0;
+    for (uint32_t i = 0; (i < h.count) && (fread(&e, sizeof(e), 1, f) == 1); i++) {
+        printf("%10u %+8d  ", e.us, i ? (int)(e.us - last) : 0);
+        last = e.us;
+        if (e.event < FTLTraceEvents) {
+            const EventFormat &ef = eventFormat[e.event];
+            printf(ef.format, eventField(e, ef.args[0]), eventField(e, ef.args[1]), eventField(e, ef.args[2]));
+        } else {
+            printf("unknown event %u (%u, %u, %u)", e.event, (unsigned)e.a, e.b, e.c);
+        }
+        printf("\n");
+    }
+    fclose(f);
+    return 0;
+}
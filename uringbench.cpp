@@ -0,0 +1,99 @@
+/*
+    UringBench.cpp - Compare host emulation backends: RAM, mmap, and io_uring
+
+    Copyright (c) 2024 Earle F. Philhower, III <earlephilhower@yahoo.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program. If not, see https://www.gnu.org/licenses/
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <cassert>
+#include <chrono>
+#include <list>
+#include <map>
+
+#include "SPIFTL.h"
+#include "FlashInterfaceRAM.h"
+#include "FlashInterfaceMmap.h"
+#include "FlashInterfaceUring.h"
+
+static double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void run(const char *name, FlashInterface *fi, int depth, int writes, int reads) {
+    SPIFTL ftl(fi);
+    ftl.format();
+    ftl.setPipelineDepth(depth);
+    int flashLBAs = ftl.lbaCount();
+
+    uint8_t lba[512];
+    bzero(lba, sizeof(lba));
+    srand(12345);
+    double start = now();
+    for (int i = 0; i < writes; i++) {
+        int x = rand() % flashLBAs;
+        sprintf((char *)lba, "lba %d rewritten at %i", x, i);
+        ftl.write(x, lba);
+    }
+    ftl.persist();
+    double writeTime = now() - start;
+    start = now();
+    for (int i = 0; i < reads; i++) {
+        ftl.read(rand() % flashLBAs, lba);
+    }
+    double readTime = now() - start;
+    assert(ftl.check());
+    printf("%-10s %6d %12.0f %12.0f\n", name, depth, writes / writeTime, reads / readTime);
+}
+
+int main(int argc, char **argv) {
+    int flashSize = 4 * 1024 * 1024;
+    int writes = 100000;
+    int reads = 100000;
+    if (argc > 1) {
+        flashSize = atoi(argv[1]) * 1024 * 1024;
+    }
+    if (argc > 2) {
+        writes = reads = atoi(argv[2]);
+    }
+    printf("%d MB flash, %d random writes then %d random reads\n", flashSize / (1024 * 1024), writes, reads);
+    printf("%-10s %6s %12s %12s\n", "backend", "depth", "writes/s", "reads/s");
+    // Private image names, so a flash.bin in the current directory is never touched
+    remove("uringbench-ram.bin");
+    remove("uringbench-ram.bin.journal");
+    {
+        FlashInterfaceRAM fi(flashSize, 4096, "uringbench-ram.bin");
+        run("ram", &fi, 0, writes, reads);
+    }
+    remove("uringbench-mmap.bin");
+    {
+        FlashInterfaceMmap fi("uringbench-mmap.bin", flashSize);
+        run("mmap", &fi, 0, writes, reads);
+    }
+    const int depths[] = {0, 8, 32};
+    for (auto d : depths) {
+        remove("uringbench-uring.bin");
+        FlashInterfaceUring fi("uringbench-uring.bin", flashSize);
+        run("io_uring", &fi, d, writes, reads);
+    }
+    remove("uringbench-ram.bin");
+    remove("uringbench-ram.bin.journal");
+    remove("uringbench-mmap.bin");
+    remove("uringbench-uring.bin");
+    return 0;
+}
@@ -0,0 +1,113 @@
+/*
+    WAFBench.cpp - Write amplification, wear spread, and throughput under synthetic FAT-like workloads
+
+    Copyright (c) 2024 Earle F. Philhower, III <earlephilhower@yahoo.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this program. If not, see https://www.gnu.org/licenses/
+*/
+
+// Usage: wafbench [passes]                         sweep all parameters
+//        wafbench passes zipf seqRun trim static   one configuration
+// This is the standard way to compare GC and placement policies, so keep the default sweep stable.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <cassert>
+#include <chrono>
+#include <list>
+#include <map>
+
+#include "SPIFTL.h"
+#include "FlashInterfaceSparseRAM.h"
+#include "FlashInterfaceCounter.h"
+#include "WorkloadGenerator.h"
+
+static double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void run(const WorkloadParams &p, int passes) {
+    FlashInterfaceSparseRAM ram(2 * 1024 * 1024);
+    FlashInterfaceCounter fi(&ram);
+    SPIFTL ftl(&fi);
+    ftl.format();
+    // Filesystems are rarely completely full, so only use 85% of the LBAs
+    int usedLBAs = ftl.lbaCount() * 85 / 100;
+    WorkloadGenerator gen(usedLBAs, p);
+
+    // Everything starts out written, so the static region really is full of cold data
+    uint8_t lba[512];
+    bzero(lba, sizeof(lba));
+    for (int i = 0; i < usedLBAs; i++) {
+        sprintf((char *)lba, "lba %d", i);
+        ftl.write(i, lba);
+    }
+    fi.reset();
+
+    long ops = (long)usedLBAs * passes;
+    long writes = 0;
+    double start = now();
+    for (long i = 0; i < ops; i++) {
+        WorkloadOp op = gen.next();
+        if (op.trim) {
+            ftl.trim(op.lba);
+        } else {
+            sprintf((char *)lba, "lba %d at %ld", op.lba, i);
+            ftl.write(op.lba, lba);
+            writes++;
+        }
+    }
+    double elapsed = now() - start;
+    assert(ftl.check());
+
+    FlashCounterSnapshot snap = fi.snapshot();
+    int minPE = 255, maxPE = 0;
+    for (int i = 0; i < ftl.ebCount(); i++) {
+        minPE = std::min(minPE, (int)ftl.getPECount(i));
+        maxPE = std::max(maxPE, (int)ftl.getPECount(i));
+    }
+    printf("%6.2f %6d %6.2f %6.2f %8ld %8.3f %8u %8d %12.0f\n", p.zipf, p.seqRun, p.trimRatio, p.staticFraction, writes,
+           snap.writeAmplification(), snap.total().erases, maxPE - minPE, ops / elapsed);
+}
+
+int main(int argc, char **argv) {
+    int passes = 10;
+    if (argc > 1) {
+        passes = atoi(argv[1]);
+    }
+    printf("2 MB flash, 85%% used, %d device passes of ops after filling\n", passes);
+    printf("%6s %6s %6s %6s %8s %8s %8s %8s %12s\n", "zipf", "seqRun", "trim", "static", "writes", "WAF", "erases", "PEspread", "ops/s");
+    if (argc == 6) {
+        WorkloadParams p = {atof(argv[2]), atoi(argv[3]), atof(argv[4]), atof(argv[5]), 12345};
+        run(p, passes);
+        return 0;
+    }
+    const double zipfs[] = {0, 0.8, 0.99, 1.2};
+    const int runs[] = {1, 8, 64};
+    const double trims[] = {0, 0.1};
+    const double statics[] = {0, 0.5};
+    for (auto s : statics) {
+        for (auto t : trims) {
+            for (auto r : runs) {
+                for (auto z : zipfs) {
+                    WorkloadParams p = {z, r, t, s, 12345};
+                    run(p, passes);
+                }
+            }
+        }
+    }
+    return 0;
+}